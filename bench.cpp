@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "engine.h"
+#include "canvas.h"
+#include "rng.h"
+#include "scenarios.h"
+#include "constants.h"
+
+// Per material microbenchmark: a world filled with loose grains of a single
+// material, stepped on one thread. Reports the cost of each cell handed to
+// World::update, which is where the material kernels run. Each material runs
+// a few times from the same start and the fastest run is kept. The forest
+// scenario burning down follows, for the cost of reactions.
+
+static const int BENCH_SIZE = 512;
+static const int BENCH_REPS = 5;
+
+static const ElementType BENCH_MATERIALS[] = { SAND, WATER, GAS, ACID, LAVA };
+static const char* const BENCH_NAMES[] = { "sand", "water", "gas", "acid", "lava" };
+// the fire needs a while to spread through the forest
+static const int FOREST_TICKS_SCALE = 10;
+
+// a walled box, 3/4 of it scattered with the material at 50% density: at the
+// top for materials that fall, at the bottom for ones that rise
+static void setupMaterial(World& world, ElementType e, uint64_t seed) {
+    uint64_t key = tickKey(seed, 0, SCENARIO_STREAM);
+    bool rises = PROPERTIES[e].density < 0;
+    for (int y = 0; y < world.height; y++) {
+        for (int x = 0; x < world.width; x++) {
+            if (x == 0 || y == 0 || x == world.width - 1 || y == world.height - 1) {
+                world.setElementAtPosition(x, y, IMMOVEABLE_SOLID);
+                continue;
+            }
+            bool band = rises ? y >= world.height / 4 : y < world.height * 3 / 4;
+            if (band && randomAt(key, x + y * world.width) & 1) world.setElementAtPosition(x, y, e);
+        }
+    }
+}
+
+// Scan benchmark: finding the cells of a chunk worth handing to World::update,
+// with a test per cell as the engine did before, and with candidateRows()
+// bitmasks. Chunks are filled at a given fraction with one material.
+static const int SCAN_CHUNKS = 4096;
+static const int SCAN_PASSES = 200;
+
+struct ScanCase {
+    const char* name;
+    ElementType e;
+    int percent;
+};
+
+static const ScanCase SCAN_CASES[] = {
+    { "air", SAND, 0 },
+    { "sparse", SAND, 5 },
+    { "half", SAND, 50 },
+    { "dense", SAND, 100 },
+    { "solid", IMMOVEABLE_SOLID, 100 },
+};
+
+static long scanCells(const World::Chunk& chunk, uint8_t epoch, int pass) {
+    long found = 0;
+    for (int y = World::chunk_size - 1; y >= 0; y--) {
+        int i = y * World::chunk_size;
+        if ((y + pass) & 1) {
+            for (int x = 0; x < World::chunk_size; x++) {
+                if (chunk.matrix[i + x] == EMPTY_CELL || chunk.matrix[i + x] == IMMOVEABLE_SOLID) continue;
+                if (chunk.epochs[i + x] == epoch) continue;
+                found += x + 1;
+            }
+        } else {
+            for (int x = World::chunk_size - 1; x >= 0; x--) {
+                if (chunk.matrix[i + x] == EMPTY_CELL || chunk.matrix[i + x] == IMMOVEABLE_SOLID) continue;
+                if (chunk.epochs[i + x] == epoch) continue;
+                found += x + 1;
+            }
+        }
+    }
+    return found;
+}
+
+static long scanBits(const World::Chunk& chunk, uint8_t epoch, int pass) {
+    long found = 0;
+    uint16_t rows[World::chunk_size];
+    World::candidateRows(&chunk, epoch, rows);
+    for (int y = World::chunk_size - 1; y >= 0; y--) {
+        uint32_t bits = rows[y];
+        while (bits) {
+            int x = (y + pass) & 1 ? __builtin_ctz(bits) : 31 - __builtin_clz(bits);
+            bits &= ~(1u << x);
+            found += x + 1;
+        }
+    }
+    return found;
+}
+
+template <typename Scan>
+static double timeScan(const std::vector<World::Chunk>& chunks, Scan scan, long& found) {
+    double best = 0;
+    for (int rep = 0; rep < BENCH_REPS; rep++) {
+        found = 0;
+        auto t1 = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < SCAN_PASSES; pass++) {
+            for (const World::Chunk& chunk : chunks) found += scan(chunk, 1, pass);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(t2 - t1).count();
+        if (rep == 0 || seconds < best) best = seconds;
+    }
+    return best * 1e9 / (double(SCAN_PASSES) * chunks.size());
+}
+
+static void benchScan() {
+    std::cout << "\nscan       per-cell ns/chunk   bitmask ns/chunk\n";
+    for (const ScanCase& scan_case : SCAN_CASES) {
+        std::vector<World::Chunk> chunks(SCAN_CHUNKS);
+        uint64_t key = tickKey(1, 0, SCENARIO_STREAM);
+        for (int c = 0; c < SCAN_CHUNKS; c++) {
+            for (int i = 0; i < World::chunk_area; i++) {
+                bool filled = int(randomAt(key, c * World::chunk_area + i) % 100) < scan_case.percent;
+                chunks[c].matrix[i] = filled ? scan_case.e : EMPTY_CELL;
+                chunks[c].epochs[i] = 0;
+            }
+        }
+        long cells_found, bits_found;
+        double cells_ns = timeScan(chunks, scanCells, cells_found);
+        double bits_ns = timeScan(chunks, scanBits, bits_found);
+        if (cells_found != bits_found) {
+            std::cerr << "scan mismatch on " << scan_case.name << "\n";
+            return;
+        }
+        printf("%-10s %18.1f %18.1f\n", scan_case.name, cells_ns, bits_ns);
+    }
+}
+
+// steps a world set up by setup for ticks, a few times, and prints a row for
+// the fastest run
+template <typename Setup>
+static void benchWorld(const char* name, int width, int height, long ticks, Setup setup) {
+    long updates = 0;
+    double seconds = 0;
+    for (int rep = 0; rep < BENCH_REPS; rep++) {
+        Engine engine(width, height, 1);
+        engine.seed(1);
+        setup(engine.world);
+
+        long rep_updates = 0;
+        auto t1 = std::chrono::steady_clock::now();
+        for (long t = 0; t < ticks; t++) {
+            engine.updateWorld();
+            rep_updates += engine.cells_updated;
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        double rep_seconds = std::chrono::duration<double>(t2 - t1).count();
+        if (rep == 0 || rep_seconds < seconds) seconds = rep_seconds;
+        updates = rep_updates;
+    }
+
+    printf("%-10s %12ld %11.2f %14.1f\n", name, updates,
+           updates ? seconds * 1e9 / updates : 0.0, updates / seconds / 1e6);
+}
+
+// Benchmark suite: fixed, seeded scenarios at the front end's world size, from
+// an idle world to one where every chunk is busy. Each runs warmup ticks, then
+// ticks measured ones, reps times from the same start, and every measured tick
+// is a sample of
+//
+//   tick    updateWorld() as a whole
+//   chunks  updateChunk(), summed over the chunks of the tick
+//   cells   World::update(), summed over the cells of the tick
+//   render  Canvas::refresh(), converting what changed to pixels
+//
+// Each of tick and render, chunks, and cells comes from runs of its own, as
+// timing the smaller pieces slows the larger ones down. cells is estimated
+// from the engine's sample of timed cell updates, less what reading the clock
+// around them costs.
+// Samples are reported as percentiles in microseconds, and can be written as
+// CSV to serve as the baseline a later run is compared against.
+static const char* const SUITE[] = { "empty", "sand", "tank", "rain", "churn" };
+static const char* const METRICS[] = { "tick", "chunks", "cells", "render" };
+static const int METRIC_COUNT = 4;
+// changes smaller than this are noise, whatever the threshold
+static const double NOISE_FLOOR_US = 1;
+
+struct SuiteOptions {
+    long warmup = 25;
+    long ticks = 100;
+    int reps = 3;
+    int threads = 1;
+    std::string only;
+};
+
+struct SuiteResult {
+    std::string scenario;
+    std::string metric;
+    long samples;
+    double mean, p50, p90, p99, max; // microseconds
+};
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(size_t(p * sorted.size()), sorted.size() - 1)];
+}
+
+static SuiteResult summarize(const std::string& scenario, const std::string& metric, std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double sample : samples) sum += sample;
+    return SuiteResult { scenario, metric, long(samples.size()), samples.empty() ? 0 : sum / samples.size(),
+                         percentile(samples, .5), percentile(samples, .9), percentile(samples, .99),
+                         samples.empty() ? 0 : samples.back() };
+}
+
+// what reading the clock once costs, in ns, for taking it back out of timed runs
+static double clockCost() {
+    const int reads = 1 << 20;
+    auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < reads; i++) std::chrono::steady_clock::now();
+    auto t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t2 - t1).count() / reads;
+}
+
+static void benchScenario(const Scenario& scenario, const SuiteOptions& options, double clock_ns, std::vector<SuiteResult>& results) {
+    std::vector<double> samples[METRIC_COUNT];
+    enum { WHOLE, CHUNKS, CELLS };
+    for (int timing = WHOLE; timing <= CELLS; timing++) {
+        for (int rep = 0; rep < options.reps; rep++) {
+            Engine engine(WIDTH, HEIGHT, options.threads);
+            engine.seed(1);
+            scenario.setup(engine.world, 1);
+            engine.time_chunks = timing == CHUNKS;
+            engine.time_cells = timing == CELLS;
+            Canvas canvas;
+            for (long t = 0; t < options.warmup + options.ticks; t++) {
+                auto t1 = std::chrono::steady_clock::now();
+                engine.updateWorld();
+                auto t2 = std::chrono::steady_clock::now();
+                if (timing == WHOLE) canvas.refresh(engine);
+                auto t3 = std::chrono::steady_clock::now();
+                if (t < options.warmup) continue;
+                if (timing == WHOLE) {
+                    samples[0].push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+                    samples[3].push_back(std::chrono::duration<double, std::micro>(t3 - t2).count());
+                } else if (timing == CHUNKS) {
+                    samples[1].push_back(engine.chunk_ns / 1000.);
+                } else {
+                    double timed = std::max(engine.update_ns - clock_ns * engine.cells_timed, 0.);
+                    samples[2].push_back(engine.cells_timed ? timed * engine.cells_updated / engine.cells_timed / 1000 : 0);
+                }
+            }
+        }
+    }
+    for (int m = 0; m < METRIC_COUNT; m++) results.push_back(summarize(scenario.name, METRICS[m], samples[m]));
+}
+
+static void printResults(const std::vector<SuiteResult>& results) {
+    printf("%-10s %-8s %10s %10s %10s %10s %10s\n", "scenario", "metric", "mean us", "p50 us", "p90 us", "p99 us", "max us");
+    for (const SuiteResult& r : results) {
+        printf("%-10s %-8s %10.1f %10.1f %10.1f %10.1f %10.1f\n", r.scenario.c_str(), r.metric.c_str(), r.mean, r.p50, r.p90, r.p99, r.max);
+    }
+}
+
+static bool writeResults(const std::vector<SuiteResult>& results, const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "can't open " << path << " for writing\n";
+        return false;
+    }
+    file << "scenario,metric,samples,mean_us,p50_us,p90_us,p99_us,max_us\n";
+    for (const SuiteResult& r : results) {
+        file << r.scenario << "," << r.metric << "," << r.samples << "," << r.mean << ","
+             << r.p50 << "," << r.p90 << "," << r.p99 << "," << r.max << "\n";
+    }
+    if (!file) {
+        std::cerr << "failed writing " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+static bool readResults(const std::string& path, std::vector<SuiteResult>& results) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "can't open " << path << "\n";
+        return false;
+    }
+    std::string line;
+    std::getline(file, line); // header
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        std::stringstream fields(line);
+        SuiteResult r;
+        std::string value[8];
+        for (int i = 0; i < 8; i++) {
+            if (!std::getline(fields, value[i], ',')) {
+                std::cerr << path << " is not a benchmark baseline\n";
+                return false;
+            }
+        }
+        r.scenario = value[0];
+        r.metric = value[1];
+        r.samples = std::atol(value[2].c_str());
+        r.mean = std::atof(value[3].c_str());
+        r.p50 = std::atof(value[4].c_str());
+        r.p90 = std::atof(value[5].c_str());
+        r.p99 = std::atof(value[6].c_str());
+        r.max = std::atof(value[7].c_str());
+        results.push_back(r);
+    }
+    return true;
+}
+
+// Medians against the baseline's; a metric regressed when its median grew by
+// more than threshold percent and by more than the noise floor. Returns how
+// many did.
+static int compareResults(const std::vector<SuiteResult>& baseline, const std::vector<SuiteResult>& results, double threshold) {
+    std::map<std::pair<std::string, std::string>, const SuiteResult*> base;
+    for (const SuiteResult& r : baseline) base[{ r.scenario, r.metric }] = &r;
+    int regressions = 0;
+    printf("\n%-10s %-8s %12s %12s %9s\n", "scenario", "metric", "base p50 us", "p50 us", "change");
+    for (const SuiteResult& r : results) {
+        auto found = base.find({ r.scenario, r.metric });
+        if (found == base.end()) {
+            printf("%-10s %-8s %12s %12.1f %9s\n", r.scenario.c_str(), r.metric.c_str(), "-", r.p50, "new");
+            continue;
+        }
+        double before = found->second->p50;
+        double change = before > 0 ? (r.p50 - before) / before * 100 : 0;
+        bool regressed = r.p50 > before * (1 + threshold / 100) && r.p50 - before > NOISE_FLOOR_US;
+        regressions += regressed;
+        printf("%-10s %-8s %12.1f %12.1f %+8.1f%%%s\n", r.scenario.c_str(), r.metric.c_str(), before, r.p50, change, regressed ? "  REGRESSED" : "");
+    }
+    return regressions;
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " [--ticks N]   per material microbenchmark\n"
+              << "       " << program << " --suite [options]   benchmark suite\n"
+              << "  --warmup N        ticks run before measuring (default 25)\n"
+              << "  --ticks N         ticks measured per repetition (default 100)\n"
+              << "  --reps N          repetitions of each scenario (default 3)\n"
+              << "  --threads N       update threads (default 1)\n"
+              << "  --only NAME       run one scenario of the suite\n"
+              << "  --csv PATH        write the results as CSV, to use as a baseline\n"
+              << "  --compare PATH    compare against a baseline CSV and exit with status 2 on a regression\n"
+              << "  --threshold PCT   how much slower a median may get before it counts as one (default 10)\n"
+              << "suite: ";
+    for (const char* name : SUITE) std::cerr << name << " ";
+    std::cerr << "\n";
+}
+
+static int runSuite(int argc, char** argv) {
+    SuiteOptions options;
+    std::string csv_path;
+    std::string compare_path;
+    double threshold = 10;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--suite")) {
+            continue;
+        } else if (!strcmp(argv[i], "--warmup") && has_value) {
+            options.warmup = std::atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--ticks") && has_value) {
+            options.ticks = std::atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--reps") && has_value) {
+            options.reps = std::atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && has_value) {
+            options.threads = std::atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--only") && has_value) {
+            options.only = argv[++i];
+        } else if (!strcmp(argv[i], "--csv") && has_value) {
+            csv_path = argv[++i];
+        } else if (!strcmp(argv[i], "--compare") && has_value) {
+            compare_path = argv[++i];
+        } else if (!strcmp(argv[i], "--threshold") && has_value) {
+            threshold = std::atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.warmup < 0 || options.ticks <= 0 || options.reps <= 0 || options.threads <= 0) {
+        std::cerr << "ticks, reps and threads must be positive\n";
+        return 1;
+    }
+    if (!options.only.empty() && std::find(std::begin(SUITE), std::end(SUITE), options.only) == std::end(SUITE)) {
+        std::cerr << "not in the suite: " << options.only << "\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+    // read first, so a bad baseline fails before the suite runs
+    std::vector<SuiteResult> baseline;
+    if (!compare_path.empty() && !readResults(compare_path, baseline)) return 1;
+
+    double clock_ns = clockCost();
+    std::cout << "world: " << WIDTH << "x" << HEIGHT << ", threads: " << options.threads << ", warmup: " << options.warmup
+              << ", ticks: " << options.ticks << ", reps: " << options.reps << ", clock read: " << clock_ns << " ns\n";
+    std::vector<SuiteResult> results;
+    for (const char* name : SUITE) {
+        if (!options.only.empty() && options.only != name) continue;
+        benchScenario(*findScenario(name), options, clock_ns, results);
+    }
+    printResults(results);
+
+    if (!csv_path.empty() && !writeResults(results, csv_path)) return 1;
+    if (!compare_path.empty()) {
+        int regressions = compareResults(baseline, results, threshold);
+        std::cout << regressions << " regression" << (regressions == 1 ? "" : "s") << " past " << threshold << "%\n";
+        if (regressions) return 2;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--suite") || !strcmp(argv[i], "--compare")) return runSuite(argc, argv);
+    }
+
+    long ticks = 200;
+    if (argc == 3 && !strcmp(argv[1], "--ticks")) ticks = std::atol(argv[2]);
+    else if (argc != 1) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::cout << "material   cell-updates   ns/update   Mupdates/sec\n";
+    for (int m = 0; m < int(sizeof(BENCH_MATERIALS) / sizeof(BENCH_MATERIALS[0])); m++) {
+        benchWorld(BENCH_NAMES[m], BENCH_SIZE, BENCH_SIZE, ticks, [m] (World& world) {
+            setupMaterial(world, BENCH_MATERIALS[m], 1);
+        });
+    }
+    benchWorld("forest", 1280, 720, ticks * FOREST_TICKS_SCALE, [] (World& world) {
+        findScenario("forest")->setup(world, 1);
+    });
+
+    benchScan();
+    return 0;
+}
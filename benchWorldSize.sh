@@ -0,0 +1,16 @@
+# memory and tick rate vs world size, headless
+# usage: ./benchWorldSize.sh [scenario] [ticks]
+SCENARIO=${1:-terrain}
+TICKS=${2:-200}
+
+[ -x ./fallingSandHeadless ] || ./build.sh headless || exit 1
+
+printf "%-10s %10s %12s %12s\n" size chunks memory_kib ticks/sec
+for SIZE in 512 1024 2048 4096 8192; do
+    ./fallingSandHeadless --scenario $SCENARIO --width $SIZE --height $SIZE --ticks $TICKS > /tmp/bench_$$.txt || exit 1
+    CHUNKS=$(grep "resident chunks" /tmp/bench_$$.txt | awk '{print $3}')
+    MEMORY=$(grep "memory" /tmp/bench_$$.txt | awk '{print $2}')
+    RATE=$(grep "ticks/sec" /tmp/bench_$$.txt | awk '{print $2}')
+    printf "%-10s %10s %12s %12s\n" ${SIZE}x${SIZE} $CHUNKS $MEMORY $RATE
+done
+rm -f /tmp/bench_$$.txt
@@ -1,2 +1,22 @@
-g++ -c -pg -g -O3 *.cpp && g++ *.o -o fallingSand -lsfml-graphics -lsfml-window -lsfml-system -pg && ./fallingSand 
-rm *.o
+CORE="world.cpp engine.cpp scenarios.cpp threadPool.cpp canvas.cpp snapshot.cpp edit.cpp journal.cpp profiler.cpp frameExchange.cpp heat.cpp rigidBodies.cpp rewind.cpp regionStore.cpp chunkRecords.cpp"
+FLAGS="-pg -g -O3 -march=native -pthread"
+
+# ./build.sh bench builds what headless does, without the gprof hooks, which
+# skew the benchmark's timings
+if [ "$1" = "bench" ]; then FLAGS="-g -O3 -march=native -pthread"; fi
+
+# PROFILE=1 ./build.sh compiles in the frame instrumentation of profiler.h
+if [ "$PROFILE" = "1" ]; then FLAGS="$FLAGS -DSAND_PROFILE"; fi
+
+# core library: world + engine, no SFML dependency
+g++ -c $FLAGS $CORE && ar rcs libsandcore.a *.o && rm *.o || exit 1
+
+# headless driver
+g++ $FLAGS headless.cpp libsandcore.a -o fallingSandHeadless || exit 1
+
+# per material microbenchmark
+g++ $FLAGS bench.cpp libsandcore.a -o fallingSandBench || exit 1
+if [ "$1" = "headless" ] || [ "$1" = "bench" ]; then exit 0; fi
+
+# interactive SFML front end
+g++ $FLAGS main.cpp simulation.cpp libsandcore.a -o fallingSand -lsfml-graphics -lsfml-window -lsfml-system && ./fallingSand
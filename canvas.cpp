@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cstring>
+#if defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+#include "canvas.h"
+#include "profiler.h"
+
+static const int chunk_size = Engine::chunk_size;
+
+Canvas::Canvas() {
+    bytes_converted = 0;
+    full_redraw = false;
+    frame_stamp = 0;
+}
+
+void Canvas::refresh(const Engine& engine) {
+    PROFILE_SCOPE("convert");
+    const World& world = engine.world;
+    engine.pendingChunks(chunks);
+    convert(world.width, world.height, chunks,
+        [&] (int index) { return engine.pendingRect(index % engine.chunks_width, index / engine.chunks_width); },
+        [&] (int x, int y, uint8_t* out) {
+            const World::Chunk* chunk = world.chunkAt(x / chunk_size, y / chunk_size);
+            if (chunk) {
+                convertRow(chunk->matrix + World::localIndex(0, y), out);
+            } else {
+                const Color color = PROPERTIES[world.fillAt(x / chunk_size, y / chunk_size)].default_color;
+                for (int i = 0; i < chunk_size; i++) std::memcpy(out + 4 * i, &color, 4);
+            }
+        });
+}
+
+void Canvas::refresh(const WorldFrame& frame) {
+    PROFILE_SCOPE("convert");
+    const int chunks_width = frame.width / chunk_size;
+    const DirtyRect whole = { 0, 0, chunk_size - 1, chunk_size - 1 };
+    if (frame.stamp != frame_stamp + 1) full_redraw = true;
+    convert(frame.width, frame.height, frame.changed,
+        [&] (int) { return whole; },
+        [&] (int x, int y, uint8_t* out) {
+            convertRow(frame.chunkCells(x / chunk_size + y / chunk_size * chunks_width) + World::localIndex(0, y), out);
+        });
+    frame_stamp = frame.stamp;
+}
+
+template <typename RectAt, typename ConvertRow>
+void Canvas::convert(int width, int height, const std::vector<int>& chunks, RectAt rect_at, ConvertRow convert_row) {
+    const int chunks_width = width / chunk_size;
+    regions.clear();
+
+    // Runs of dirty chunks along a chunk row make one region, as tall as the
+    // union of their rects. A run covering the same chunk columns as a region
+    // ending right above it extends that region instead.
+    std::vector<size_t> open; // regions reaching the bottom of the previous chunk row
+    std::vector<size_t> next_open;
+    if (full_redraw) regions.push_back(Region { 0, 0, width, height, 0 });
+    int last_row = -1;
+    for (size_t i = 0; i < chunks.size() && !full_redraw;) {
+        const int yy = chunks[i] / chunks_width;
+        if (yy != last_row + 1) open.clear();
+        last_row = yy;
+        next_open.clear();
+        while (i < chunks.size() && chunks[i] / chunks_width == yy) {
+            if (rect_at(chunks[i]).empty()) {
+                i++;
+                continue;
+            }
+            const int first = chunks[i] % chunks_width;
+            int xx = first;
+            int min_y = chunk_size - 1;
+            int max_y = 0;
+            for (; xx < chunks_width && i < chunks.size() && chunks[i] == xx + yy * chunks_width; i++, xx++) {
+                DirtyRect rect = rect_at(chunks[i]);
+                if (rect.empty()) break;
+                min_y = std::min<int>(min_y, rect.min_y);
+                max_y = std::max<int>(max_y, rect.max_y);
+            }
+            Region run = { first * chunk_size, yy * chunk_size + min_y, (xx - first) * chunk_size, max_y - min_y + 1, 0 };
+
+            size_t index = regions.size();
+            for (size_t j : open) {
+                Region& above = regions[j];
+                if (above.x != run.x || above.width != run.width || above.y + above.height != run.y) continue;
+                above.height += run.height;
+                index = j;
+                break;
+            }
+            if (index == regions.size()) regions.push_back(run);
+            if (max_y == chunk_size - 1) next_open.push_back(index);
+        }
+        std::swap(open, next_open);
+    }
+
+    size_t size = 0;
+    for (Region& region : regions) {
+        region.offset = size;
+        size += 4 * size_t(region.width) * region.height;
+    }
+    if (pixels.size() < size) pixels.resize(size);
+    bytes_converted = size;
+    full_redraw = false;
+    PROFILE_COUNTER("bytes converted", bytes_converted);
+
+    for (const Region& region : regions) {
+        uint8_t* out = pixels.data() + region.offset;
+        for (int y = region.y; y < region.y + region.height; y++) {
+            for (int x = region.x; x < region.x + region.width; x += chunk_size) {
+                convert_row(x, y, out);
+                out += 4 * chunk_size;
+            }
+        }
+    }
+}
+
+#if defined(__SSSE3__)
+// The palette is split into one 16 entry table per channel, so a shuffle looks
+// up a channel for all 16 cells of a row at once; interleaving the four
+// channels gives the RGBA pixels.
+void Canvas::convertRow(const ElementType* cells, uint8_t* out) {
+    static_assert(chunk_size == 16 && ELEMENT_COUNT <= 16, "rows must be 16 cells and materials fit a nibble");
+    static const struct Channels {
+        alignas(16) uint8_t r[16], g[16], b[16], a[16];
+        Channels() : r(), g(), b(), a() {
+            for (int e = 0; e < ELEMENT_COUNT; e++) {
+                r[e] = PROPERTIES[e].default_color.r;
+                g[e] = PROPERTIES[e].default_color.g;
+                b[e] = PROPERTIES[e].default_color.b;
+                a[e] = PROPERTIES[e].default_color.a;
+            }
+        }
+    } channels;
+
+    __m128i materials = _mm_loadu_si128((const __m128i*) cells);
+    __m128i r = _mm_shuffle_epi8(_mm_load_si128((const __m128i*) channels.r), materials);
+    __m128i g = _mm_shuffle_epi8(_mm_load_si128((const __m128i*) channels.g), materials);
+    __m128i b = _mm_shuffle_epi8(_mm_load_si128((const __m128i*) channels.b), materials);
+    __m128i a = _mm_shuffle_epi8(_mm_load_si128((const __m128i*) channels.a), materials);
+    __m128i rg_low = _mm_unpacklo_epi8(r, g);
+    __m128i rg_high = _mm_unpackhi_epi8(r, g);
+    __m128i ba_low = _mm_unpacklo_epi8(b, a);
+    __m128i ba_high = _mm_unpackhi_epi8(b, a);
+    _mm_storeu_si128((__m128i*) (out + 0), _mm_unpacklo_epi16(rg_low, ba_low));
+    _mm_storeu_si128((__m128i*) (out + 16), _mm_unpackhi_epi16(rg_low, ba_low));
+    _mm_storeu_si128((__m128i*) (out + 32), _mm_unpacklo_epi16(rg_high, ba_high));
+    _mm_storeu_si128((__m128i*) (out + 48), _mm_unpackhi_epi16(rg_high, ba_high));
+}
+#else
+void Canvas::convertRow(const ElementType* cells, uint8_t* out) {
+    for (int i = 0; i < chunk_size; i++) std::memcpy(out + 4 * i, &PROPERTIES[cells[i]].default_color, 4);
+}
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "engine.h"
+#include "frameExchange.h"
+
+// The Canvas turns what changed in the world since the last frame into RGBA
+// pixels, without depending on SFML. The engine's pending dirty rects are
+// coalesced into rectangles spanning whole chunk columns, and each one is
+// converted, a chunk row at a time, straight into a packed buffer that a front
+// end can hand to a sub-rectangle texture upload. Nothing outside them is
+// touched, so a frame costs what changed rather than what is on screen.
+class Canvas {
+public:
+    struct Region {
+        int x, y, width, height; // in cells
+        size_t offset;           // of the region's first byte in pixels
+    };
+
+    // regions converted by the last refresh() and their pixels, packed one
+    // region after the other, row by row, 4 bytes per cell
+    std::vector<Region> regions;
+    std::vector<uint8_t> pixels;
+
+    long bytes_converted; // by the last refresh(), which is also what needs uploading
+
+    Canvas();
+
+    // converts every cell the engine will update next tick, which covers every
+    // cell that changed since the last tick
+    void refresh(const Engine& engine);
+    // converts what changed since the frame refreshed from last, for a render
+    // thread that only sees the frames of a FrameExchange. Chunks are converted
+    // whole, as frames keep no rects of what changed inside them. Frames must be
+    // refreshed from one after the other; after a gap the whole world is.
+    void refresh(const WorldFrame& frame);
+
+    // the next refresh() converts the whole world, for when it was replaced
+    // without going through the dirty rects
+    void invalidate() { full_redraw = true; }
+
+    // writes the colors of the chunk_size cells of a chunk row to out
+    static void convertRow(const ElementType* cells, uint8_t* out);
+
+private:
+    bool full_redraw;
+    uint64_t frame_stamp; // of the last frame refreshed from
+    std::vector<int> chunks; // the engine's pending chunks, scratch
+
+    // converts the given chunks, in index order, as far as rect_at(index) says
+    template <typename RectAt, typename ConvertRow>
+    void convert(int width, int height, const std::vector<int>& chunks, RectAt rect_at, ConvertRow convert_row);
+};
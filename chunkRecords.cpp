@@ -0,0 +1,66 @@
+#include <cstring>
+#include "chunkRecords.h"
+
+static const int chunk_area = World::chunk_area;
+
+size_t writeRuns(const uint8_t* bytes, uint8_t* out) {
+    uint16_t size = 0;
+    uint8_t* runs = out + 2;
+    for (int i = 0; i < chunk_area;) {
+        int run = 1;
+        while (i + run < chunk_area && run < 256 && bytes[i + run] == bytes[i]) run++;
+        runs[size++] = run - 1;
+        runs[size++] = bytes[i];
+        i += run;
+    }
+    std::memcpy(out, &size, 2);
+    return 2 + size;
+}
+
+bool readRuns(const uint8_t*& data, const uint8_t* end, int limit, uint8_t* out) {
+    uint16_t size;
+    if (end - data < 2) return false;
+    std::memcpy(&size, data, 2);
+    data += 2;
+    if (end - data < size || size % 2) return false;
+    int i = 0;
+    for (const uint8_t* run = data; run < data + size; run += 2) {
+        int length = run[0] + 1;
+        if (i + length > chunk_area || run[1] >= limit) return false;
+        std::memset(out + i, run[1], length);
+        i += length;
+    }
+    data += size;
+    return i == chunk_area;
+}
+
+size_t writeFill(ElementType fill, uint8_t* out) {
+    out[0] = FILL_ENCODING;
+    out[1] = fill;
+    return 2;
+}
+
+size_t writeChunk(const ElementType* matrix, const uint16_t* settled, const uint8_t* speeds, uint8_t* out) {
+    size_t size = 1 + writeRuns((const uint8_t*) matrix, out + 1);
+    if (size - 3 < size_t(chunk_area)) {
+        out[0] = RLE_ENCODING;
+    } else {
+        out[0] = RAW_ENCODING;
+        std::memcpy(out + 1, matrix, chunk_area);
+        size = 1 + chunk_area;
+    }
+    std::memcpy(out + size, settled, sizeof(World::Chunk::settled));
+    size += sizeof(World::Chunk::settled);
+    return size + writeRuns(speeds, out + size);
+}
+
+bool readMaterials(const uint8_t*& data, const uint8_t* end, uint8_t encoding, ElementType* matrix) {
+    if (encoding == RLE_ENCODING) return readRuns(data, end, ELEMENT_COUNT, (uint8_t*) matrix);
+    if (encoding != RAW_ENCODING || end - data < chunk_area) return false;
+    for (int i = 0; i < chunk_area; i++) {
+        if (data[i] >= ELEMENT_COUNT) return false;
+    }
+    std::memcpy(matrix, data, chunk_area);
+    data += chunk_area;
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "world.h"
+
+// How snapshots, region files and the rewind history encode chunks, so they
+// share one codec. A plane of chunk_area bytes is stored as runs: its payload
+// size (u16), then (run length - 1, byte) pairs. A chunk record holds, after
+// whatever its file puts in front, an encoding (u8), then
+//   FILL  the material of a chunk that owns no planes (u8)
+//   RLE   the materials as runs
+//   RAW   chunk_area materials, when runs would take as much
+// and for RLE and RAW the settled rows (chunk_size x u16), then the speeds as
+// runs.
+enum ChunkEncoding : uint8_t {
+    FILL_ENCODING,
+    RLE_ENCODING,
+    RAW_ENCODING,
+};
+
+// a bound on the size of a chunk record from its encoding on
+const size_t MAX_CHUNK_RECORD = 1 + 2 + 2 * World::chunk_area + sizeof(World::Chunk::settled) + 2 + 2 * World::chunk_area;
+
+// writes the runs of the chunk_area bytes, payload size first, and returns
+// their size, at most 2 + 2 * chunk_area
+size_t writeRuns(const uint8_t* bytes, uint8_t* out);
+// reads runs of bytes all below limit into chunk_area bytes and moves data
+// past them; false if malformed
+bool readRuns(const uint8_t*& data, const uint8_t* end, int limit, uint8_t* out);
+
+// write a chunk record from its encoding on and return its size
+size_t writeFill(ElementType fill, uint8_t* out);
+size_t writeChunk(const ElementType* matrix, const uint16_t* settled, const uint8_t* speeds, uint8_t* out);
+// reads the materials of an RLE or RAW record, which data points right after
+// the encoding of, and moves data past them; false if malformed
+bool readMaterials(const uint8_t*& data, const uint8_t* end, uint8_t encoding, ElementType* matrix);
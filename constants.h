@@ -1,3 +1,4 @@
 #pragma once
 #define WIDTH 1280 
 #define HEIGHT 720
+#define TICK_RATE 60 // ticks per second the front end runs at, 0 for as fast as it can
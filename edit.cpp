@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "edit.h"
+#include "profiler.h"
+#include "regionStore.h"
+
+WorldEdit WorldEdit::circle(int x, int y, int radius, ElementType e, ElementType only) {
+    return WorldEdit { CIRCLE, e, only, x, y, x, y, radius, nullptr };
+}
+
+WorldEdit WorldEdit::stroke(int x1, int y1, int x2, int y2, int radius, ElementType e, ElementType only) {
+    return WorldEdit { STROKE, e, only, x1, y1, x2, y2, radius, nullptr };
+}
+
+WorldEdit WorldEdit::rect(int x1, int y1, int x2, int y2, ElementType e, ElementType only) {
+    return WorldEdit { RECT, e, only, x1, y1, x2, y2, 0, nullptr };
+}
+
+WorldEdit WorldEdit::replace(int x1, int y1, int x2, int y2, ElementType from, ElementType to) {
+    return rect(x1, y1, x2, y2, to, from);
+}
+
+WorldEdit WorldEdit::stamp(int x, int y, std::shared_ptr<const EditImage> image, ElementType only) {
+    return WorldEdit { STAMP, NULL_ELEMENT, only, x, y, x, y, 0, std::move(image) };
+}
+
+DirtyBox WorldEdit::bounds() const {
+    DirtyBox box;
+    const int r = std::max(radius, 0);
+    switch (shape) {
+        case CIRCLE:
+        case STROKE:
+            box.include(std::min(x1, x2) - r, std::min(y1, y2) - r);
+            box.include(std::max(x1, x2) + r, std::max(y1, y2) + r);
+            break;
+        case RECT:
+            box.include(x1, y1);
+            box.include(x2, y2);
+            break;
+        case STAMP:
+            if (!image || image->width <= 0 || image->height <= 0) break;
+            box.include(x1, y1);
+            box.include(x1 + image->width - 1, y1 + image->height - 1);
+            break;
+    }
+    return box;
+}
+
+// largest h with h * h <= n
+static int squareRoot(int n) {
+    int h = (int) std::sqrt((double) n);
+    while (h * h > n) h--;
+    while ((h + 1) * (h + 1) <= n) h++;
+    return h;
+}
+
+// widens [low, high] to the part of row y within radius of (x, y0)
+static void coverCircle(double& low, double& high, double x, double y0, double radius, double y) {
+    double d = y - y0;
+    if (d * d > radius * radius) return;
+    double h = std::sqrt(radius * radius - d * d);
+    low = std::min(low, x - h);
+    high = std::max(high, x + h);
+}
+
+// widens [low, high] to the part of row y the edge from a to b crosses
+static void coverEdge(double& low, double& high, double ax, double ay, double bx, double by, double y) {
+    if (y < std::min(ay, by) || y > std::max(ay, by)) return;
+    if (ay == by) {
+        low = std::min(low, std::min(ax, bx));
+        high = std::max(high, std::max(ax, bx));
+        return;
+    }
+    double x = ax + (y - ay) * (bx - ax) / (by - ay);
+    low = std::min(low, x);
+    high = std::max(high, x);
+}
+
+// Calls span(y, x1, x2, element) for every row of the edit, top to bottom. The
+// spans are not clipped to the world.
+template <typename F>
+static void rasterize(const WorldEdit& edit, F span) {
+    const int r = std::max(edit.radius, 0);
+    switch (edit.shape) {
+        case WorldEdit::CIRCLE:
+            for (int dy = -r; dy <= r; dy++) {
+                int half = squareRoot(r * r - dy * dy);
+                span(edit.y1 + dy, edit.x1 - half, edit.x1 + half, edit.element);
+            }
+            break;
+
+        case WorldEdit::STROKE: {
+            if (edit.x1 == edit.x2 && edit.y1 == edit.y2) {
+                rasterize(WorldEdit::circle(edit.x1, edit.y1, r, edit.element, edit.only), span);
+                break;
+            }
+            if (r == 0) {
+                // A capsule of radius 0 is thinner than a cell and misses most
+                // of them, so it's a line instead, max(|dx|, |dy|) + 1 cells,
+                // walked from the top end with one span per row.
+                const bool down = edit.y1 <= edit.y2;
+                const int x1 = down ? edit.x1 : edit.x2, y1 = down ? edit.y1 : edit.y2;
+                const int x2 = down ? edit.x2 : edit.x1, y2 = down ? edit.y2 : edit.y1;
+                const int dx = std::abs(x2 - x1), dy = y2 - y1, step = x1 < x2 ? 1 : -1;
+                int x = x1, y = y1, start = x1;
+                int error = dx - dy;
+                while (x != x2 || y != y2) {
+                    const int twice = 2 * error;
+                    int next_x = x, next_y = y;
+                    if (twice >= -dy) {
+                        error -= dy;
+                        next_x += step;
+                    }
+                    if (twice <= dx) {
+                        error += dx;
+                        next_y++;
+                    }
+                    if (next_y != y) {
+                        span(y, std::min(start, x), std::max(start, x), edit.element);
+                        start = next_x;
+                    }
+                    x = next_x;
+                    y = next_y;
+                }
+                span(y, std::min(start, x), std::max(start, x), edit.element);
+                break;
+            }
+            // A capsule is convex, so each row crosses it once: from the
+            // leftmost to the rightmost point of the two end circles and of
+            // the rectangle swept between them.
+            double dx = edit.x2 - edit.x1, dy = edit.y2 - edit.y1;
+            double length = std::sqrt(dx * dx + dy * dy);
+            double nx = -dy / length * r, ny = dx / length * r;
+            double corners[4][2] = {
+                { edit.x1 + nx, edit.y1 + ny }, { edit.x2 + nx, edit.y2 + ny },
+                { edit.x2 - nx, edit.y2 - ny }, { edit.x1 - nx, edit.y1 - ny },
+            };
+            // cells on the boundary are in, as for circles
+            const double epsilon = 1e-9;
+            for (int y = std::min(edit.y1, edit.y2) - r; y <= std::max(edit.y1, edit.y2) + r; y++) {
+                double low = INFINITY, high = -INFINITY;
+                coverCircle(low, high, edit.x1, edit.y1, r, y);
+                coverCircle(low, high, edit.x2, edit.y2, r, y);
+                for (int i = 0; i < 4; i++) {
+                    const double* a = corners[i];
+                    const double* b = corners[(i + 1) % 4];
+                    coverEdge(low, high, a[0], a[1], b[0], b[1], y);
+                }
+                if (low > high) continue;
+                span(y, (int) std::ceil(low - epsilon), (int) std::floor(high + epsilon), edit.element);
+            }
+            break;
+        }
+
+        case WorldEdit::RECT:
+            for (int y = std::min(edit.y1, edit.y2); y <= std::max(edit.y1, edit.y2); y++) {
+                span(y, std::min(edit.x1, edit.x2), std::max(edit.x1, edit.x2), edit.element);
+            }
+            break;
+
+        case WorldEdit::STAMP: {
+            if (!edit.image) break;
+            const EditImage& image = *edit.image;
+            // runs of one material, skipping transparent cells
+            for (int y = 0; y < image.height; y++) {
+                const ElementType* row = image.cells.data() + size_t(y) * image.width;
+                for (int x = 0; x < image.width;) {
+                    int end = x;
+                    while (end + 1 < image.width && row[end + 1] == row[x]) end++;
+                    if (row[x] != NULL_ELEMENT) span(edit.y1 + y, edit.x1 + x, edit.x1 + end, row[x]);
+                    x = end + 1;
+                }
+            }
+            break;
+        }
+    }
+}
+
+int applyEdit(Engine& engine, const WorldEdit& edit) {
+    World& world = engine.world;
+    int changed = 0;
+    // Changed cells are gathered a band of chunk rows at a time, which marks
+    // each chunk about once without waking much more than was painted, even
+    // for long diagonal strokes.
+    DirtyBox band;
+    int band_yy = -1;
+    auto flush = [&] {
+        if (band.empty()) return;
+        world.unsettle(band.min_x - 1, band.min_y - 1, band.max_x + 1, band.max_y + 1);
+        engine.markDirtyBox(band);
+        band = DirtyBox();
+    };
+    rasterize(edit, [&] (int y, int x1, int x2, ElementType e) {
+        if (e >= ELEMENT_COUNT) return;
+        int count = world.fillSpan(x1, x2, y, e, edit.only);
+        if (!count) return;
+        if (y >> World::chunk_shift != band_yy) {
+            flush();
+            band_yy = y >> World::chunk_shift;
+        }
+        band.include(std::max(x1, 0), y);
+        band.include(std::min(x2, world.width - 1), y);
+        changed += count;
+    });
+    flush();
+    return changed;
+}
+
+void paintStroke(Engine& engine, const Brush& brush, int x1, int y1, int x2, int y2) {
+    applyEdit(engine, WorldEdit::stroke(x1, y1, x2, y2, brush.radius, brush.element));
+}
+
+EditQueue::EditQueue() {
+    store = nullptr;
+}
+
+void EditQueue::push(const WorldEdit& edit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(edit);
+}
+
+void EditQueue::push(const std::vector<WorldEdit>& batch) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.insert(pending.end(), batch.begin(), batch.end());
+}
+
+long EditQueue::apply(Engine& engine) {
+    {
+        // producers only wait for the swap, never for the painting
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.empty()) return 0;
+        std::swap(pending, applying);
+    }
+    PROFILE_SCOPE("applyEdits");
+    long changed = 0;
+    for (const WorldEdit& edit : applying) {
+        if (store) {
+            // what an edit unsettles and marks dirty reaches a cell past what
+            // it paints
+            DirtyBox box = edit.bounds();
+            if (!box.empty()) store->require(box.min_x - 1, box.min_y - 1, box.max_x + 1, box.max_y + 1);
+        }
+        changed += applyEdit(engine, edit);
+    }
+    PROFILE_COUNTER("cells edited", changed);
+    applying.clear();
+    return changed;
+}
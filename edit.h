@@ -0,0 +1,82 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "engine.h"
+
+class RegionStore;
+
+// What the player paints with.
+struct Brush {
+    ElementType element;
+    int radius;
+};
+
+// Materials to stamp into the world, row by row. NULL_ELEMENT cells are
+// transparent and leave the world under them as it is.
+struct EditImage {
+    int width, height;
+    std::vector<ElementType> cells;
+};
+
+// One change to the world, in world coordinates. Every shape is rasterized as
+// horizontal spans clipped to the world, and what it changed is unsettled and
+// marked dirty a band of chunk rows at a time rather than cell by cell.
+struct WorldEdit {
+    enum Shape : uint8_t { CIRCLE, STROKE, RECT, STAMP } shape;
+    ElementType element; // all but STAMP, whose image brings its own
+    // only cells holding this material change; NULL_ELEMENT paints over anything
+    ElementType only;
+    int x1, y1; // CIRCLE centre, STROKE start, RECT corner, STAMP top left
+    int x2, y2; // STROKE end, RECT opposite corner (inclusive)
+    int radius; // CIRCLE and STROKE: cells at most radius away are covered
+    std::shared_ptr<const EditImage> image; // STAMP
+
+    // brushes paint into empty cells only
+    static WorldEdit circle(int x, int y, int radius, ElementType e, ElementType only = EMPTY_CELL);
+    // a circle swept along the segment, a capsule; of radius 0, a line of cells
+    static WorldEdit stroke(int x1, int y1, int x2, int y2, int radius, ElementType e, ElementType only = EMPTY_CELL);
+    static WorldEdit rect(int x1, int y1, int x2, int y2, ElementType e, ElementType only = NULL_ELEMENT);
+    // every from in the rect becomes to
+    static WorldEdit replace(int x1, int y1, int x2, int y2, ElementType from, ElementType to);
+    static WorldEdit stamp(int x, int y, std::shared_ptr<const EditImage> image, ElementType only = NULL_ELEMENT);
+
+    // the cells it may change, not clipped to the world
+    DirtyBox bounds() const;
+};
+
+// Applies the edit right away and returns how many cells it changed. Only
+// between ticks, on the thread that runs them.
+int applyEdit(Engine& engine, const WorldEdit& edit);
+
+// Paints the brush along the line from (x1, y1) to (x2, y2), in world
+// coordinates, into empty cells only, and marks what it painted dirty. Shared
+// by the front end and journal replay, so both paint exactly the same cells.
+void paintStroke(Engine& engine, const Brush& brush, int x1, int y1, int x2, int y2);
+
+// Edits pushed from any number of threads, such as the UI and scripted load
+// generators, for the thread that runs the ticks to apply between two of them,
+// so none of them races the update threads. Edits apply in the order they
+// were pushed, and a batch pushed at once is never split across ticks.
+class EditQueue {
+public:
+    EditQueue();
+
+    // any thread
+    void push(const WorldEdit& edit);
+    void push(const std::vector<WorldEdit>& batch);
+
+    // the thread that runs the ticks, between them; returns how many cells
+    // changed
+    long apply(Engine& engine);
+
+    // with a store, apply() first reads back the regions each edit reaches,
+    // so none of them lands on a chunk that is paged out
+    void setStore(RegionStore* store) { this->store = store; }
+
+private:
+    RegionStore* store;
+    std::mutex mutex;
+    std::vector<WorldEdit> pending;
+    std::vector<WorldEdit> applying; // swapped with pending, so neither reallocates
+};
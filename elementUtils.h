@@ -1,8 +1,9 @@
 #pragma once
-#include <SFML/Graphics.hpp>
+#include <cstdint>
 #include <limits.h>
 
-enum ElementType : int32_t {
+// stored as a single byte per cell
+enum ElementType : uint8_t {
     EMPTY_CELL,
     IMMOVEABLE_SOLID,
     SAND,
@@ -12,7 +13,14 @@ enum ElementType : int32_t {
     WOOD,
     FIRE,
     LAVA,
-    NULL_ELEMENT = -1
+    ELEMENT_COUNT,
+    NULL_ELEMENT = 0xFF // outside the world, never stored
+};
+
+// rgba color with the same memory layout as sf::Color, so the core stays free of
+// SFML while the front end can still hand the pixel buffer straight to a texture
+struct Color {
+    uint8_t r, g, b, a;
 };
 
 // in most cases, a value of -1 means Not Applicable
@@ -20,8 +28,8 @@ struct ElementProperties {
     int density; // solids: INT_MAX, powders & liquids: +int, gases -int, empty: INT_MIN
     int blast_resistance;
 
-    float corrodability; // chance from 0 to 1 to die if acid is above
-    float flammability; // chance from 0 to 1 to catch fire
+    float corrodability; // chance from 0 to 1 to die next to acid, per tick
+    float flammability; // chance from 0 to 1 to catch fire next to fire or lava, per tick
     
     float chance_to_die; // chance to die on a frame. 0 for no chance.
     
@@ -29,10 +37,10 @@ struct ElementProperties {
     int friction;
     int dispersion_rate;
 
-    sf::Color default_color;
+    Color default_color;
 };
 
-inline const ElementProperties PROPERTIES[] = {
+inline constexpr ElementProperties PROPERTIES[] = {
     // EMPTY_CELL
     ElementProperties {
         .density            = INT_MIN,
@@ -42,7 +50,7 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 0,
-        .default_color      = sf::Color::Transparent,
+        .default_color      = Color { 0, 0, 0, 0 },
     },
     // IMMOVEABLE_SOLID
     ElementProperties {
@@ -53,7 +61,7 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 0,
-        .default_color      = sf::Color::White,
+        .default_color      = Color { 255, 255, 255, 255 },
     },
     // SAND
     ElementProperties {
@@ -64,7 +72,7 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 5,
         .dispersion_rate    = 0,
-        .default_color      = sf::Color::Yellow,
+        .default_color      = Color { 255, 255, 0, 255 },
     },
     // WATER
     ElementProperties {
@@ -75,7 +83,7 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 5,
-        .default_color      = sf::Color::Cyan,
+        .default_color      = Color { 0, 255, 255, 255 },
     },
     // GAS 
     ElementProperties {
@@ -86,7 +94,7 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 8,
-        .default_color      = sf::Color::Green,
+        .default_color      = Color { 0, 255, 0, 255 },
     },
     // ACID
     ElementProperties {
@@ -97,18 +105,18 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 5,
-        .default_color      = sf::Color::Green,
+        .default_color      = Color { 160, 255, 60, 255 },
     },
     // WOOD
     ElementProperties {
         .density            = 8,
         .blast_resistance   = INT_MAX,
-        .corrodability      = 0,
-        .flammability       = 0,
+        .corrodability      = 0.05,
+        .flammability       = 0.2,
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 0,
-        .default_color      = sf::Color(139, 69, 19), // brown
+        .default_color      = Color { 139, 69, 19, 255 }, // brown
     },
     // FIRE
     ElementProperties {
@@ -119,7 +127,7 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0.004,
         .friction           = 0,
         .dispersion_rate    = 0,
-        .default_color      = sf::Color::Red,
+        .default_color      = Color { 255, 0, 0, 255 },
     },
     // LAVA
     ElementProperties {
@@ -130,9 +138,180 @@ inline const ElementProperties PROPERTIES[] = {
         .chance_to_die      = 0,
         .friction           = 0,
         .dispersion_rate    = 2,
-        .default_color      = sf::Color::Red,
+        .default_color      = Color { 255, 110, 0, 255 },
     },
 
 };
 
 
+
+// How a material moves. Every tick a particle tries, in this order, to fall in
+// its direction, to slide diagonally, and to disperse sideways up to dispersion
+// cells; every move is a single swap with the cell it displaces, however far the
+// particle goes. Materials with no direction never move. World::update compiles
+// one kernel per material from these, so a rule that is off costs nothing.
+//
+// Falling particles carry a speed in cells per tick, which builds up by one for
+// every tick they fall freely, up to max_speed. A fall covers that many empty
+// cells in one move; falling into anything else it displaces brakes a particle
+// back to one cell per tick. Landing keeps (10 - friction) tenths of the speed,
+// and every slide or dispersal after that loses as much again, at least one
+// cell's worth. Until it runs out, the speed is how far a particle may slide
+// down a diagonal, and how far it disperses when that beats its dispersion.
+const int MAX_SPEED = 8; // cells per tick, see maxReach() in world.cpp
+
+struct MovementRules {
+    int direction;  // 1 falls, -1 rises, 0 static
+    bool slides;    // diagonal steps
+    int dispersion; // horizontal reach in cells, 0 for none
+    int max_speed;  // cells per tick, 1 to move a cell at a time
+    int friction;   // tenths of its speed a particle loses on landing and sliding
+};
+
+constexpr MovementRules movementRules(ElementType e) {
+    switch (e) {
+        case SAND:  return MovementRules { 1, true, 0, MAX_SPEED, PROPERTIES[SAND].friction };
+        case WATER: return MovementRules { 1, true, PROPERTIES[WATER].dispersion_rate, MAX_SPEED, PROPERTIES[WATER].friction };
+        case ACID:  return MovementRules { 1, true, PROPERTIES[ACID].dispersion_rate, MAX_SPEED, PROPERTIES[ACID].friction };
+        case LAVA:  return MovementRules { 1, true, PROPERTIES[LAVA].dispersion_rate, MAX_SPEED / 2, PROPERTIES[LAVA].friction }; // thick
+        case GAS:   return MovementRules { -1, true, PROPERTIES[GAS].dispersion_rate, 1, PROPERTIES[GAS].friction };
+        default:    return MovementRules { 0, false, 0, 1, 0 };
+    }
+}
+
+// How materials react. Every tick a cell of a reacting material rolls once for
+// each of its 4 neighbours: next to a cell of b, a becomes actor_into and b
+// becomes neighbour_into with probability chance / REACTION_CERTAIN. Materials
+// with a chance_to_die also burn out into empty cells. All of it is tabled
+// from the properties at compile time, so the kernel only looks up and
+// compares, however many materials react.
+const int REACTION_BITS = 12; // of randomness per roll
+const int REACTION_CERTAIN = 1 << REACTION_BITS;
+
+constexpr uint16_t reactionChance(float p) {
+    return uint16_t(p * REACTION_CERTAIN + .5f);
+}
+
+struct Reaction {
+    ElementType actor_into;
+    ElementType neighbour_into;
+    uint16_t chance; // out of REACTION_CERTAIN, 0 for none
+};
+
+constexpr Reaction reaction(ElementType a, ElementType b) {
+    const float flammability = PROPERTIES[b].flammability;
+    const float corrodability = PROPERTIES[b].corrodability;
+    switch (a) {
+        case FIRE:
+            if (b == WATER) return Reaction { EMPTY_CELL, WATER, REACTION_CERTAIN }; // doused
+            if (flammability > 0) return Reaction { FIRE, FIRE, reactionChance(flammability) };
+            break;
+        case LAVA:
+            // cools into rock, boiling the water away
+            if (b == WATER) return Reaction { IMMOVEABLE_SOLID, EMPTY_CELL, reactionChance(.25) };
+            if (flammability > 0) return Reaction { LAVA, FIRE, reactionChance(flammability) };
+            break;
+        case ACID:
+            // used up by what it eats
+            if (corrodability > 0) return Reaction { EMPTY_CELL, EMPTY_CELL, reactionChance(corrodability) };
+            break;
+        default:
+            break;
+    }
+    return Reaction { a, b, 0 };
+}
+
+constexpr uint16_t decayChance(ElementType e) {
+    return reactionChance(PROPERTIES[e].chance_to_die);
+}
+
+// Rows are indexed by neighbour & 31, so NULL_ELEMENT past the world border
+// lands on an entry that never reacts.
+struct ReactionTable {
+    Reaction pairs[ELEMENT_COUNT][32];
+    uint32_t partners[ELEMENT_COUNT]; // bit b is set if a reacts with b
+
+    constexpr const Reaction* operator[](int a) const { return pairs[a]; }
+};
+
+constexpr ReactionTable makeReactionTable() {
+    ReactionTable table = {};
+    for (int a = 0; a < ELEMENT_COUNT; a++) {
+        for (int b = 0; b < 32; b++) {
+            table.pairs[a][b] = b < ELEMENT_COUNT ? reaction(ElementType(a), ElementType(b)) : Reaction { ElementType(a), NULL_ELEMENT, 0 };
+            if (table.pairs[a][b].chance) table.partners[a] |= 1u << b;
+        }
+    }
+    return table;
+}
+
+inline constexpr ReactionTable REACTIONS = makeReactionTable();
+
+constexpr bool reacts(ElementType e) {
+    if (decayChance(e)) return true;
+    for (int b = 0; b < ELEMENT_COUNT; b++) {
+        if (reaction(e, ElementType(b)).chance) return true;
+    }
+    return false;
+}
+
+// How a material takes part in the temperature field of heat.h. Every cell of
+// it adds output degrees to its tile each tick, and once its tile is at least
+// transition degrees above ambient it turns into transition_into, with chance
+// per tick; 0 for no transition.
+struct HeatRules {
+    int output;
+    int transition;
+    ElementType transition_into;
+    float chance;
+};
+
+constexpr HeatRules heatRules(ElementType e) {
+    switch (e) {
+        case FIRE:  return HeatRules { 2, 0, FIRE, 0 };
+        case LAVA:  return HeatRules { 4, 0, LAVA, 0 };
+        case WATER: return HeatRules { 0, 100, EMPTY_CELL, .05 }; // boils away
+        case GAS:   return HeatRules { 0, 150, FIRE, .5 };
+        case WOOD:  return HeatRules { 0, 250, FIRE, .02 };       // catches from radiant heat
+        case SAND:  return HeatRules { 0, 1500, LAVA, .002 };     // melts
+        default:    return HeatRules { 0, 0, e, 0 };
+    }
+}
+
+// bit e is set if World::update can do anything with a cell of e: it moves or
+// reacts. Cells of any other material, such as wood waiting to catch fire, are
+// skipped by the engine without being looked at further.
+constexpr uint32_t activeElements() {
+    uint32_t mask = 0;
+    for (int e = 0; e < ELEMENT_COUNT; e++) {
+        if (movementRules(ElementType(e)).direction != 0 || reacts(ElementType(e))) mask |= 1u << e;
+    }
+    return mask;
+}
+
+inline constexpr uint32_t ACTIVE_ELEMENTS = activeElements();
+
+// Bit o of DISPLACES[e] is set if e may swap into a cell holding o: o is
+// lighter than e and is empty or itself moves, so nothing sinks into wood.
+// NULL_ELEMENT maps to bit 31, which is never set, so a kernel can test
+// (DISPLACES[e] >> (o & 31)) & 1 without checking for the world border first.
+static_assert(ELEMENT_COUNT < 32, "displacement masks hold one bit per element");
+
+struct DisplacementTable {
+    uint32_t masks[ELEMENT_COUNT];
+
+    constexpr uint32_t operator[](int e) const { return masks[e]; }
+};
+
+constexpr DisplacementTable makeDisplacementTable() {
+    DisplacementTable table = {};
+    for (int e = 0; e < ELEMENT_COUNT; e++) {
+        for (int o = 0; o < ELEMENT_COUNT; o++) {
+            bool loose = o == EMPTY_CELL || movementRules(ElementType(o)).direction != 0;
+            if (loose && PROPERTIES[o].density < PROPERTIES[e].density) table.masks[e] |= 1u << o;
+        }
+    }
+    return table;
+}
+
+inline constexpr DisplacementTable DISPLACES = makeDisplacementTable();
@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include "engine.h"
+#include "rng.h"
+#include "profiler.h"
+
+static const DirtyRect EMPTY_RECT = { 255, 255, 0, 0 };
+
+static uint32_t packRect(DirtyRect rect) {
+    uint32_t packed;
+    std::memcpy(&packed, &rect, sizeof(packed));
+    return packed;
+}
+
+static DirtyRect unpackRect(uint32_t packed) {
+    DirtyRect rect;
+    std::memcpy(&rect, &packed, sizeof(rect));
+    return rect;
+}
+
+Engine::Engine(int world_width, int world_height, int thread_count) :
+    world(world_width, world_height),
+    chunks_width(world.chunks_width),
+    chunks_height(world.chunks_height),
+    thread_pool(std::max(thread_count, 1)),
+    bodies(world_width, world_height),
+    heat(world_width, world_height),
+    thread_stats(thread_pool.size()),
+    rects(chunks_width * chunks_height, packRect(EMPTY_RECT)),
+    next_rects(chunks_width * chunks_height),
+    pending_words((chunks_width * chunks_height + 63) / 64)
+{
+    tick_count = 0;
+    held_chunks = nullptr;
+    epoch = 0;
+    rng_seed = 0;
+    row_key = 0;
+    cells_visited = 0;
+    cells_updated = 0;
+    cells_moved = 0;
+    active_chunks = 0;
+    time_chunks = false;
+    time_cells = false;
+    chunk_ns = 0;
+    update_ns = 0;
+    cells_timed = 0;
+
+    // everything needs updating on the first tick
+    markAllDirty();
+}
+
+int Engine::defaultThreadCount() {
+    return std::max<int>(std::thread::hardware_concurrency(), 1);
+}
+
+void Engine::seed(uint64_t seed) {
+    rng_seed = seed;
+}
+
+void Engine::reset() {
+    world.reset();
+    bodies.reset();
+    heat.reset();
+    tick_count = 0;
+    markAllDirty();
+}
+
+static long nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Engine::updateChunk(int xx, int yy, int thread) {
+    ThreadStats& stats = thread_stats[thread];
+    if (!time_chunks) return stepChunk(xx, yy, stats);
+    long start = nowNs();
+    stepChunk(xx, yy, stats);
+    stats.chunk_ns += nowNs() - start;
+}
+
+void Engine::stepChunk(int xx, int yy, ThreadStats& stats) {
+    DirtyRect rect = unpackRect(rects[xx + yy * chunks_width]);
+    if (rect.empty()) return;
+    World::Chunk* chunk = world.chunkAt(xx, yy);
+    if (!chunk) {
+        // nothing in a chunk of one material that neither moves nor reacts,
+        // such as empty cells, solid or wood, can change
+        ElementType fill = world.fillAt(xx, yy);
+        if (!(ACTIVE_ELEMENTS >> fill & 1)) return;
+        chunk = world.materialize(xx, yy);
+    }
+    stats.cells_visited += rect.area();
+
+    // Cells that could do something this tick are found up front, a row per
+    // bitmask, and only those are visited. A cell that turns into a candidate
+    // while the chunk is updating was moved, and so already stepped.
+    //
+    // Settled candidates are left out. The settled bits of a row are read once
+    // it is reached, and again after every move along it, so cells woken by
+    // the moves below them or beside them still step this tick.
+    uint16_t candidates[chunk_size];
+    World::candidateRows(chunk, epoch, candidates);
+    // neighbours clear rows without touching the summary, so it is redone here
+    chunk->settled_rows = 0;
+    for (int y = 0; y < chunk_size; y++) chunk->settled_rows |= (chunk->settled[y] != 0) << y;
+    const uint32_t columns = ((2u << rect.max_x) - 1) & ~((1u << rect.min_x) - 1);
+
+    DirtyBox dirty;
+    for (int local_y = rect.max_y; local_y >= rect.min_y; local_y--) {
+        int y = yy * chunk_size + local_y;
+        uint32_t row = candidates[local_y] & columns; // not visited yet
+        uint32_t bits = row & ~chunk->settled[local_y];
+        bool left_to_right = randomAt(row_key, y * chunks_width + xx) & 1;
+        while (bits) {
+            int local_x = left_to_right ? __builtin_ctz(bits) : 31 - __builtin_clz(bits);
+            bits &= ~(1u << local_x);
+            row &= ~(1u << local_x);
+            int i = local_y * chunk_size + local_x;
+            // a candidate may since have been swapped away or stepped
+            if (!(ACTIVE_ELEMENTS >> chunk->matrix[i] & 1)) continue;
+            if (chunk->epochs[i] == epoch) continue;
+            chunk->epochs[i] = epoch; // set stepped
+            stats.cells_updated++;
+            bool changed;
+            if (time_cells && stats.cells_updated % CELL_SAMPLING == 0) {
+                long start = nowNs();
+                changed = world.update(chunk, xx * chunk_size + local_x, y, dirty);
+                stats.update_ns += nowNs() - start;
+                stats.cells_timed++;
+            } else {
+                changed = world.update(chunk, xx * chunk_size + local_x, y, dirty);
+            }
+            if (changed) {
+                stats.cells_moved++;
+                bits = row & ~chunk->settled[local_y];
+            } else {
+                chunk->settled[local_y] |= 1u << local_x;
+                chunk->settled_rows |= 1u << local_y;
+            }
+        }
+    }
+
+    // only chunks the changed cells (plus a 1 cell margin) reach into are woken
+    markDirtyBox(dirty);
+    // Moves only unsettled cells of this chunk. Neighbours update in another
+    // phase, so their cells can wait until now, as one coarser box.
+    if (!dirty.empty()) world.unsettle(dirty.min_x - 1, dirty.min_y - 1, dirty.max_x + 1, dirty.max_y + 1, chunk);
+
+    // Cells blocked by a neighbour chunk that updates later in this tick saw
+    // that chunk's old state and may be free to move once it has, so the rect
+    // stays dirty rather than falling asleep one row at a time.
+    int phase = (xx & 1) + 2 * (yy & 1);
+    for (int y = yy - 1; y <= yy + 1; y++) {
+        for (int x = xx - 1; x <= xx + 1; x++) {
+            if (y >= chunks_height || y < 0 || x >= chunks_width || x < 0) continue;
+            if ((x & 1) + 2 * (y & 1) <= phase) continue;
+            if (unpackRect(rects[x + y * chunks_width]).empty()) continue;
+            if ((x < xx && rect.min_x > 0) || (x > xx && rect.max_x < chunk_size - 1)) continue;
+            if ((y < yy && rect.min_y > 0) || (y > yy && rect.max_y < chunk_size - 1)) continue;
+            mergeNextRect(xx, yy, rect);
+            return;
+        }
+    }
+}
+
+void Engine::updateWorld() {
+    PROFILE_SCOPE("updateWorld");
+    for (ThreadStats& stats : thread_stats) stats = ThreadStats {};
+
+    {
+        PROFILE_SCOPE("tick setup");
+        // A fresh epoch marks what steps this tick. Only once a cycle runs out
+        // (every max_epoch ticks) do old stamps need clearing.
+        if (epoch == World::max_epoch) {
+            world.clearEpochs();
+            epoch = 0;
+        }
+        epoch++;
+
+        world.random_key = tickKey(rng_seed, tick_count, CELL_STREAM);
+        world.reaction_key = tickKey(rng_seed, tick_count, REACTION_STREAM);
+        world.epoch = epoch;
+        row_key = tickKey(rng_seed, tick_count, ROW_STREAM);
+
+        // what was marked dirty since the last tick is what this tick updates,
+        // apart from held chunks, which stay pending
+        for (int i : active) rects[i] = packRect(EMPTY_RECT);
+        active.clear();
+        for (size_t w = 0; w < pending_words.size(); w++) {
+            if (!pending_words[w].load(std::memory_order_relaxed)) continue;
+            uint64_t bits = pending_words[w].exchange(0, std::memory_order_relaxed);
+            uint64_t held = 0;
+            for (; bits; bits &= bits - 1) {
+                int i = w * 64 + __builtin_ctzll(bits);
+                if (held_chunks && (*held_chunks)[i]) {
+                    held |= bits & -bits;
+                    continue;
+                }
+                rects[i] = next_rects[i].exchange(packRect(EMPTY_RECT), std::memory_order_relaxed);
+                active.push_back(i);
+            }
+            if (held) pending_words[w].fetch_or(held, std::memory_order_relaxed);
+        }
+        for (std::vector<int>& chunks : phase_chunks) chunks.clear();
+        for (int i : active) {
+            int xx = i % chunks_width, yy = i / chunks_width;
+            phase_chunks[(xx & 1) | (yy & 1) << 1].push_back(i);
+        }
+    }
+
+    // The chunk grid is updated in 4 checkerboard phases. Chunks of one phase
+    // are 2 chunks apart, and an update only reads or writes cells at most half
+    // a chunk outside its own chunk, so no two chunks of a phase can touch the
+    // same cell and a phase can be spread across all threads. parallelFor()
+    // acts as the barrier between phases. Since the phases are the same for any
+    // thread count, so is the result.
+#ifdef SAND_PROFILE
+    static const char* const PHASE_NAMES[4] = { "phase 0", "phase 1", "phase 2", "phase 3" };
+#endif
+    active_chunks = active.size();
+    for (int phase = 0; phase < 4; phase++) {
+        PROFILE_SCOPE(PHASE_NAMES[phase]);
+        const std::vector<int>& chunks = phase_chunks[phase];
+        thread_pool.parallelFor(chunks.size(), [this, &chunks] (int task, int thread) {
+            updateChunk(chunks[task] % chunks_width, chunks[task] / chunks_width, thread);
+        });
+    }
+
+    pendingChunks(pending);
+    touched_chunks.clear();
+    std::set_union(active.begin(), active.end(), pending.begin(), pending.end(), std::back_inserter(touched_chunks));
+    bodies.step(*this);
+    heat.step(*this);
+
+    // chunks that just fell asleep give their planes back if they are uniform
+    {
+        PROFILE_SCOPE("compact");
+        for (int i : active) {
+            if (!unpackRect(next_rects[i].load(std::memory_order_relaxed)).empty()) continue;
+            world.compact(i % chunks_width, i / chunks_width);
+        }
+    }
+
+    cells_visited = 0;
+    cells_updated = 0;
+    cells_moved = 0;
+    chunk_ns = 0;
+    update_ns = 0;
+    cells_timed = 0;
+    for (ThreadStats& stats : thread_stats) {
+        cells_visited += stats.cells_visited;
+        cells_updated += stats.cells_updated;
+        cells_moved += stats.cells_moved;
+        chunk_ns += stats.chunk_ns;
+        update_ns += stats.update_ns;
+        cells_timed += stats.cells_timed;
+    }
+    PROFILE_COUNTER("active chunks", active_chunks);
+    PROFILE_COUNTER("cells visited", cells_visited);
+    PROFILE_COUNTER("cells updated", cells_updated);
+    PROFILE_COUNTER("cells moved", cells_moved);
+
+    tick_count++;
+}
+
+void Engine::markDirty(int x, int y) {
+    DirtyBox box;
+    box.include(x, y);
+    markDirtyBox(box);
+}
+
+void Engine::markDirtyBox(const DirtyBox& box) {
+    if (box.empty()) return;
+    // a changed cell may let any of its neighbours move
+    int min_x = std::max(box.min_x - 1, 0);
+    int min_y = std::max(box.min_y - 1, 0);
+    int max_x = std::min(box.max_x + 1, world.width - 1);
+    int max_y = std::min(box.max_y + 1, world.height - 1);
+    if (min_x > max_x || min_y > max_y) return;
+
+    for (int yy = min_y / chunk_size; yy <= max_y / chunk_size; yy++) {
+        for (int xx = min_x / chunk_size; xx <= max_x / chunk_size; xx++) {
+            DirtyRect rect;
+            rect.min_x = std::max(min_x - xx * chunk_size, 0);
+            rect.min_y = std::max(min_y - yy * chunk_size, 0);
+            rect.max_x = std::min(max_x - xx * chunk_size, chunk_size - 1);
+            rect.max_y = std::min(max_y - yy * chunk_size, chunk_size - 1);
+            mergeNextRect(xx, yy, rect);
+        }
+    }
+}
+
+void Engine::markAllDirty() {
+    const DirtyRect full = { 0, 0, chunk_size - 1, chunk_size - 1 };
+    for (std::atomic<uint32_t>& rect : next_rects) rect.store(packRect(full), std::memory_order_relaxed);
+    const int count = chunks_width * chunks_height;
+    for (size_t w = 0; w < pending_words.size(); w++) {
+        int bits = std::min<int>(count - w * 64, 64);
+        pending_words[w].store(bits == 64 ? ~0ULL : (1ULL << bits) - 1, std::memory_order_relaxed);
+    }
+}
+
+void Engine::markDirtyRect(int xx, int yy, DirtyRect rect) {
+    if (!rect.empty()) mergeNextRect(xx, yy, rect);
+}
+
+void Engine::clearDirty() {
+    for (std::atomic<uint32_t>& rect : next_rects) rect.store(packRect(EMPTY_RECT), std::memory_order_relaxed);
+    for (std::atomic<uint64_t>& word : pending_words) word.store(0, std::memory_order_relaxed);
+}
+
+void Engine::clearDirty(int xx, int yy) {
+    const int index = xx + yy * chunks_width;
+    next_rects[index].store(packRect(EMPTY_RECT), std::memory_order_relaxed);
+    pending_words[index / 64].fetch_and(~(1ULL << (index % 64)), std::memory_order_relaxed);
+}
+
+DirtyRect Engine::pendingRect(int xx, int yy) const {
+    return unpackRect(next_rects[xx + yy * chunks_width].load(std::memory_order_relaxed));
+}
+
+void Engine::pendingChunks(std::vector<int>& out) const {
+    out.clear();
+    for (size_t w = 0; w < pending_words.size(); w++) {
+        for (uint64_t bits = pending_words[w].load(std::memory_order_relaxed); bits; bits &= bits - 1) {
+            out.push_back(w * 64 + __builtin_ctzll(bits));
+        }
+    }
+}
+
+void Engine::mergeNextRect(int xx, int yy, DirtyRect rect) {
+    const int index = xx + yy * chunks_width;
+    std::atomic<uint32_t>& target = next_rects[index];
+    uint32_t expected = target.load(std::memory_order_relaxed);
+    while (true) {
+        DirtyRect merged = unpackRect(expected);
+        merged.min_x = std::min(merged.min_x, rect.min_x);
+        merged.min_y = std::min(merged.min_y, rect.min_y);
+        merged.max_x = std::max(merged.max_x, rect.max_x);
+        merged.max_y = std::max(merged.max_y, rect.max_y);
+        if (packRect(merged) == expected) return;
+        if (target.compare_exchange_weak(expected, packRect(merged), std::memory_order_relaxed)) {
+            // whoever makes the rect non-empty lists the chunk
+            if (unpackRect(expected).empty()) pending_words[index / 64].fetch_or(1ULL << (index % 64), std::memory_order_relaxed);
+            return;
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include "world.h"
+#include "heat.h"
+#include "rigidBodies.h"
+#include "threadPool.h"
+
+// Inclusive bounding box of the cells of a chunk that need updating, in chunk
+// local coordinates. An empty rect has min > max.
+struct DirtyRect {
+    uint8_t min_x, min_y, max_x, max_y;
+
+    bool empty() const { return min_x > max_x; }
+    int area() const { return empty() ? 0 : (max_x - min_x + 1) * (max_y - min_y + 1); }
+};
+
+// The Engine class owns the world together with everything needed to step it:
+// the per chunk dirty rects, the worker threads and the tick counter. It knows
+// nothing about windows, textures or input, so it can be driven by the headless
+// driver as well as by the SFML front end, which is only a thin client on top
+// of it.
+class Engine {
+public:
+    World world;
+
+    const static int chunk_size = World::chunk_size;
+    const int chunks_width;
+    const int chunks_height;
+
+    ThreadPool thread_pool;
+
+    // stepped by updateWorld() after the chunks, in this order
+    RigidBodies bodies;
+    HeatField heat;
+
+    long tick_count;
+
+    // Per chunk, by index, if set: the tick leaves nonzero chunks alone until
+    // they are released. Pending ones keep their rect without being updated,
+    // and rigid bodies wait for them. For whoever keeps part of the world out
+    // of memory, see RegionStore.
+    const std::vector<uint8_t>* held_chunks;
+
+    // statistics of the last updateWorld()
+    long cells_visited; // cells iterated over inside the dirty rects
+    long cells_updated; // active, unstepped cells handed to World::update
+    long cells_moved;   // cells World::update changed
+    long active_chunks; // chunks with a non-empty dirty rect
+
+    // Only kept when a benchmark asks: with time_chunks set, the nanoseconds
+    // the last updateWorld() spent in updateChunk(), summed over threads. With
+    // time_cells set, one in CELL_SAMPLING calls of World::update() is timed,
+    // and update_ns sums those, cells_timed counts them. Both read the clock
+    // inside the other, so they are best taken from separate ticks.
+    const static int CELL_SAMPLING = 16;
+    bool time_chunks;
+    bool time_cells;
+    long chunk_ns;
+    long update_ns;
+    long cells_timed;
+
+    // world dimensions must be multiples of chunk_size
+    Engine(int world_width, int world_height, int thread_count = defaultThreadCount());
+    ~Engine() = default;
+
+    static int defaultThreadCount();
+
+    // the seed all randomness of the simulation derives from
+    void seed(uint64_t seed);
+    uint64_t rngSeed() const { return rng_seed; }
+    void reset();
+
+    void updateChunk(int xx, int yy, int thread);
+    void updateWorld();
+
+    // dirty tracking. Cells marked dirty, and their 8 neighbours, are updated
+    // on the next tick.
+    void markDirty(int x, int y);
+    void markDirtyBox(const DirtyBox& box); // clipped to the world
+    void markAllDirty();
+    void markDirtyRect(int xx, int yy, DirtyRect rect); // in chunk local coordinates
+    void clearDirty(); // nothing is updated next tick
+    void clearDirty(int xx, int yy); // chunk (xx, yy) is not
+
+    // cells of chunk (xx, yy) that will be updated next tick. Every cell that
+    // changed since the last updateWorld() lies inside it.
+    DirtyRect pendingRect(int xx, int yy) const;
+    // the chunks with a non-empty pendingRect(), by index, found in time that
+    // follows their number rather than the world's
+    void pendingChunks(std::vector<int>& out) const;
+    // chunks the last updateWorld() updated or left changes pending in, by
+    // index. What steps after the chunks only looks at these for new work.
+    const std::vector<int>& touchedChunks() const { return touched_chunks; }
+
+private:
+    // per thread counters, padded so workers don't share cache lines
+    struct alignas(64) ThreadStats {
+        long cells_visited;
+        long cells_updated;
+        long cells_moved;
+        long chunk_ns;
+        long update_ns;
+        long cells_timed;
+    };
+    std::vector<ThreadStats> thread_stats;
+
+    // dirty rects indexed by xx + yy * chunks_width, packed with packRect().
+    // rects is what the current tick iterates, next_rects collects what the
+    // next one will; it is atomic because chunks of one phase may grow the
+    // same neighbour concurrently.
+    std::vector<uint32_t> rects;
+    std::vector<std::atomic<uint32_t>> next_rects;
+    // Bit i % 64 of pending_words[i / 64] is set once next_rects[i] stops
+    // being empty, so the chunks to update next are collected from these words
+    // instead of from every chunk, and a nearly idle world costs nearly nothing.
+    std::vector<std::atomic<uint64_t>> pending_words;
+    std::vector<int> active;          // chunks with a non-empty rect in rects, by index
+    std::vector<int> phase_chunks[4]; // active chunks of each phase
+    std::vector<int> pending;         // scratch for pendingChunks()
+    std::vector<int> touched_chunks;
+
+    uint32_t epoch; // stamped on cells stepped during the current tick
+
+    uint64_t rng_seed;
+    uint64_t row_key; // tickKey() of ROW_STREAM for the current tick
+
+    void stepChunk(int xx, int yy, ThreadStats& stats); // updateChunk() without the timing
+    void mergeNextRect(int xx, int yy, DirtyRect rect);
+};
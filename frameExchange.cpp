@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cstring>
+#include "frameExchange.h"
+#include "profiler.h"
+
+FrameExchange::FrameExchange(const Engine& engine) :
+    chunks_width(engine.chunks_width),
+    chunks_height(engine.chunks_height)
+{
+    const size_t chunk_count = size_t(chunks_width) * chunks_height;
+    for (WorldFrame& frame : frames) {
+        frame.width = engine.world.width;
+        frame.height = engine.world.height;
+        frame.stamp = 0;
+        frame.tick = 0;
+        frame.cells.resize(chunk_count * World::chunk_area);
+        frame.rects.assign(chunk_count, DirtyRect { 1, 1, 0, 0 });
+    }
+    back = 0;
+    ready.store(1, std::memory_order_relaxed);
+    front = 2;
+    // the first frame carries everything
+    stamp = 1;
+    changed.assign(chunk_count, 0);
+    invalidate();
+}
+
+void FrameExchange::mark(int index) {
+    if (changed[index] == stamp) return;
+    changed[index] = stamp;
+    changed_lists[stamp % 3].push_back(index);
+}
+
+void FrameExchange::collect(const Engine& engine) {
+    engine.pendingChunks(pending);
+    for (int index : pending) mark(index);
+}
+
+bool FrameExchange::publish(const Engine& engine) {
+    collect(engine);
+    if (ready.load(std::memory_order_acquire) & FRESH) return false;
+    PROFILE_SCOPE("publish");
+
+    // the back frame holds the world as of its last publish, so it misses
+    // exactly the chunks that changed in a later frame
+    WorldFrame& frame = frames[back];
+    const World& world = engine.world;
+    long chunks_copied = 0;
+    const DirtyRect none = { 1, 1, 0, 0 };
+    for (int index : frame.pending) frame.rects[index] = none;
+    for (int index : pending) frame.rects[index] = engine.pendingRect(index % chunks_width, index / chunks_width);
+    frame.pending = pending;
+    // a chunk listed for several of the frames is copied for its last one only
+    for (uint64_t s = frame.stamp + 1; s <= stamp; s++) {
+        for (int index : changed_lists[s % 3]) {
+            if (changed[index] != s) continue;
+            const int xx = index % chunks_width;
+            const int yy = index / chunks_width;
+            ElementType* cells = frame.cells.data() + size_t(index) * World::chunk_area;
+            const World::Chunk* chunk = world.chunkAt(xx, yy);
+            if (chunk) std::memcpy(cells, chunk->matrix, World::chunk_area);
+            else std::memset(cells, world.fillAt(xx, yy), World::chunk_area);
+            chunks_copied++;
+        }
+    }
+    PROFILE_COUNTER("chunks copied", chunks_copied);
+    std::vector<int>& current = changed_lists[stamp % 3];
+    std::sort(current.begin(), current.end());
+    frame.changed = current;
+    frame.stamp = stamp++;
+    frame.tick = engine.tick_count;
+    changed_lists[stamp % 3].clear();
+
+    back = ready.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    return true;
+}
+
+void FrameExchange::invalidate() {
+    for (size_t index = 0; index < changed.size(); index++) mark(index);
+}
+
+const WorldFrame* FrameExchange::take() {
+    if (!(ready.load(std::memory_order_acquire) & FRESH)) return nullptr;
+    front = ready.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+    return &frames[front];
+}
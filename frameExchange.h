@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "engine.h"
+
+// The materials of the whole world as of one tick, for a render thread to read
+// while the simulation is already stepping the next ones. Cells are laid out
+// chunk by chunk, each chunk like World::Chunk::matrix.
+struct WorldFrame {
+    int width, height; // in cells
+    uint64_t stamp; // frames are numbered in the order they are published
+    long tick;
+    std::vector<ElementType> cells;
+    std::vector<int> changed;     // chunks that changed since the previous frame, in index order
+    std::vector<int> pending;     // chunks with a pending rect, in index order
+    std::vector<DirtyRect> rects; // per chunk, the engine's pending rects for debug overlays, empty outside pending
+
+    const ElementType* chunkCells(int index) const { return cells.data() + size_t(index) * World::chunk_area; }
+};
+
+// Hands frames from the simulation thread to a render thread without either
+// one waiting on the other. Three frames rotate: the simulation fills the back
+// one, the newest published one waits in the middle, and the render thread
+// reads the one it took last. Publishing only copies the chunks that changed
+// since the back frame was last published, which the engine's pending rects
+// tell, so a frame costs about what changed rather than the whole world. The
+// changed chunks are kept as a list per frame, never found by walking them all.
+class FrameExchange {
+public:
+    FrameExchange(const Engine& engine);
+
+    // simulation thread. collect() must run before every updateWorld(), so
+    // edits made between ticks are seen before the tick moves the dirty rects
+    // on; publish() collects too, and only copies and publishes once the
+    // render thread took the previous frame, returning whether it did.
+    void collect(const Engine& engine);
+    bool publish(const Engine& engine);
+    // the next frame carries every chunk, for when the world was replaced
+    // without going through the dirty rects
+    void invalidate();
+
+    // render thread: the newest frame, or nullptr if none was published since
+    // the last call. It stays valid until the next call.
+    const WorldFrame* take();
+
+private:
+    const static int FRESH = 4; // set on ready while its frame wasn't taken
+
+    WorldFrame frames[3];
+    int back;               // simulation thread only
+    std::atomic<int> ready; // index of the newest frame, with FRESH
+    int front;              // render thread only
+
+    const int chunks_width;
+    const int chunks_height;
+    std::vector<uint64_t> changed; // per chunk, stamp of the last frame to carry it
+    uint64_t stamp;                // of the next frame published
+    // the chunks that changed for frame s are listed in changed_lists[s % 3]:
+    // the back frame is at most three frames behind, so these lists always
+    // cover what it misses
+    std::vector<int> changed_lists[3];
+    std::vector<int> pending;      // the engine's pending chunks, scratch
+
+    void mark(int index);
+};
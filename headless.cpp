@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "engine.h"
+#include "canvas.h"
+#include "frameExchange.h"
+#include "rewind.h"
+#include "regionStore.h"
+#include "timestep.h"
+#include "snapshot.h"
+#include "edit.h"
+#include "journal.h"
+#include "profiler.h"
+#include "scenarios.h"
+#include "constants.h"
+
+// Headless driver: steps the engine without a window, for profiling and soak
+// testing on machines without a display.
+
+static void printUsage(const char* program) {
+    std::cerr << "usage: " << program << " [options]\n"
+              << "  --ticks N          number of ticks to simulate (default 1000)\n"
+              << "  --seed N           rng seed (default 1)\n"
+              << "  --width N          world width, multiple of " << Engine::chunk_size << " (default " << WIDTH << ")\n"
+              << "  --height N         world height, multiple of " << Engine::chunk_size << " (default " << HEIGHT << ")\n"
+              << "  --scenario NAME    initial world (default sand)\n"
+              << "  --threads N        update threads (default " << Engine::defaultThreadCount() << ")\n"
+              << "  --load PATH        start from a snapshot instead of a scenario, at its size\n"
+              << "  --save PATH        write a snapshot once the ticks have run\n"
+              << "  --replay PATH      replay an input journal at full speed, at its size and seed\n"
+              << "  --hash-at N,M,...  print the world hash after these ticks\n"
+              << "  --trace PATH       write the profile as Chrome trace JSON (needs PROFILE=1 ./build.sh)\n"
+              << "  --csv PATH         write the profile as CSV (needs PROFILE=1 ./build.sh)\n"
+              << "  --render           convert the changed cells to pixels after every tick, as the front end used to\n"
+              << "  --pipeline         convert published frames on a render thread while the ticks run, as the front end does\n"
+              << "  --edits N          queue N random brush, rect, replace and stamp edits before every tick\n"
+              << "  --tick-rate N      pace the ticks at N per second, as the front end does, and report the rate achieved\n"
+              << "  --rewind MB        record every tick into a rewind buffer of MB megabytes, then seek back to its middle\n"
+              << "  --page-dir DIR     page idle regions out to a region store in DIR, or resume the map already there\n"
+              << "  --page-budget MB   chunk memory to page idle regions down to (default 64)\n"
+              << "  --check-strokes    check that brush strokes of radius 0 paint unbroken lines, then exit\n"
+              << "scenarios:\n";
+    for (int i = 0; i < scenario_count; i++) {
+        std::cerr << "  " << SCENARIOS[i].name << ": " << SCENARIOS[i].description << "\n";
+    }
+}
+
+// Strokes of radius 0 in every direction, each of which must paint the cells
+// of a line, max(|dx|, |dy|) + 1 of them. Returns how many didn't.
+static int checkStrokes() {
+    int checks = 0, failures = 0;
+    for (int dy = -24; dy <= 24; dy += 3) {
+        for (int dx = -24; dx <= 24; dx += 2) {
+            Engine engine(64, 64, 1);
+            int painted = applyEdit(engine, WorldEdit::stroke(32, 32, 32 + dx, 32 + dy, 0, SAND));
+            int expected = std::max(std::abs(dx), std::abs(dy)) + 1;
+            checks++;
+            if (painted == expected) continue;
+            failures++;
+            std::cerr << "stroke to (" << dx << ", " << dy << ") painted " << painted << " cells, expected " << expected << "\n";
+        }
+    }
+    std::cout << "stroke checks: " << checks - failures << " of " << checks << " passed\n";
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    long ticks = 1000;
+    uint64_t seed = 1;
+    int width = WIDTH;
+    int height = HEIGHT;
+    std::string scenario_name = "sand";
+    int threads = Engine::defaultThreadCount();
+    bool render = false;
+    bool pipeline = false;
+    std::string load_path;
+    std::string save_path;
+    std::string replay_path;
+    std::vector<long> hash_ticks;
+    std::string trace_path;
+    std::string csv_path;
+    int edits_per_tick = 0;
+    long rewind_mb = 0;
+    double tick_rate = 0;
+    std::string page_dir;
+    long page_budget_mb = 64;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--ticks") && has_value) {
+            ticks = std::atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && has_value) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--width") && has_value) {
+            width = std::atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--height") && has_value) {
+            height = std::atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--scenario") && has_value) {
+            scenario_name = argv[++i];
+        } else if (!strcmp(argv[i], "--threads") && has_value) {
+            threads = std::atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--load") && has_value) {
+            load_path = argv[++i];
+        } else if (!strcmp(argv[i], "--save") && has_value) {
+            save_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && has_value) {
+            replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--hash-at") && has_value) {
+            for (char* tick = strtok(argv[++i], ","); tick; tick = strtok(nullptr, ",")) hash_ticks.push_back(std::atol(tick));
+        } else if (!strcmp(argv[i], "--trace") && has_value) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--csv") && has_value) {
+            csv_path = argv[++i];
+        } else if (!strcmp(argv[i], "--render")) {
+            render = true;
+        } else if (!strcmp(argv[i], "--pipeline")) {
+            pipeline = true;
+        } else if (!strcmp(argv[i], "--edits") && has_value) {
+            edits_per_tick = std::atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--tick-rate") && has_value) {
+            tick_rate = std::atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--rewind") && has_value) {
+            rewind_mb = std::atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--page-dir") && has_value) {
+            page_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--page-budget") && has_value) {
+            page_budget_mb = std::atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--check-strokes")) {
+            return checkStrokes() ? 2 : 0;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+#ifndef SAND_PROFILE
+    if (!trace_path.empty() || !csv_path.empty()) {
+        std::cerr << "built without profiling, rebuild with PROFILE=1 ./build.sh\n";
+        return 1;
+    }
+#endif
+
+    // a snapshot brings its own world size, a journal its size and seed
+    if (!load_path.empty() && !snapshotSize(load_path, width, height)) return 1;
+    JournalReplay replay;
+    if (!replay_path.empty()) {
+        if (!replay.open(replay_path)) return 1;
+        width = replay.width;
+        height = replay.height;
+        seed = replay.seed;
+        ticks = replay.steps;
+    }
+
+    if (width <= 0 || height <= 0 || width % Engine::chunk_size || height % Engine::chunk_size) {
+        std::cerr << "world dimensions must be positive multiples of " << Engine::chunk_size << "\n";
+        return 1;
+    }
+    const Scenario* scenario = findScenario(scenario_name);
+    if (!scenario) {
+        std::cerr << "unknown scenario: " << scenario_name << "\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (tick_rate < 0) {
+        std::cerr << "tick rate must be positive\n";
+        return 1;
+    }
+
+    if (threads <= 0) {
+        std::cerr << "thread count must be positive\n";
+        return 1;
+    }
+
+    // those read or write the whole world between ticks, regions on disk too
+    if (!page_dir.empty() && (!replay_path.empty() || rewind_mb > 0 || !hash_ticks.empty())) {
+        std::cerr << "--page-dir can't be combined with --replay, --rewind or --hash-at\n";
+        return 1;
+    }
+    if (page_budget_mb < 0) {
+        std::cerr << "page budget can't be negative\n";
+        return 1;
+    }
+
+    Engine engine(width, height, threads);
+    engine.seed(seed);
+    double load_seconds = 0;
+    if (!replay_path.empty()) {
+        // journals start from an empty world
+    } else if (load_path.empty()) {
+        // a map in the page directory takes over from the scenario
+        if (page_dir.empty() || !RegionStore::holdsMap(page_dir)) scenario->setup(engine.world, seed);
+    } else {
+        auto l1 = std::chrono::steady_clock::now();
+        if (!loadSnapshot(engine, load_path)) return 1;
+        load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - l1).count();
+        seed = engine.rngSeed();
+    }
+
+    long total_cells_visited = 0;
+    long total_cells_updated = 0;
+    long total_cells_moved = 0;
+    long total_hot_chunks = 0;
+    long total_falling_bodies = 0;
+    Canvas canvas;
+    long total_bytes_converted = 0;
+    long total_regions = 0;
+    double render_seconds = 0;
+    double hash_seconds = 0;
+    Brush brush = { EMPTY_CELL, 0 };
+    EditQueue edits;
+    std::vector<WorldEdit> batch;
+    double edit_seconds = 0;
+    long total_cells_edited = 0;
+    // a blob with a hole, for stamps
+    auto image = std::make_shared<EditImage>(EditImage { 24, 24, std::vector<ElementType>(24 * 24, WOOD) });
+    for (int i = 0; i < 24 * 24; i++) {
+        int x = i % 24 - 12, y = i / 24 - 12;
+        if (x * x + y * y < 36) image->cells[i] = NULL_ELEMENT;
+    }
+
+    std::unique_ptr<RegionStore> store;
+    if (!page_dir.empty()) {
+        store.reset(new RegionStore(engine, page_dir, size_t(page_budget_mb) << 20));
+        if (!store->open()) return 1;
+        edits.setStore(store.get());
+        // a resumed map goes on with its own seed
+        seed = engine.rngSeed();
+    }
+    double page_seconds = 0;
+    size_t peak_resident = 0;
+    double total_resident = 0;
+
+    std::unique_ptr<RewindBuffer> rewind;
+    if (rewind_mb > 0) rewind.reset(new RewindBuffer(engine, size_t(rewind_mb) << 20));
+    double rewind_seconds = 0;
+    long delta_bytes = 0, delta_ticks = 0;
+    long keyframe_bytes = 0, keyframes = 0;
+
+    // the render thread converts whatever frame is newest, as fast as it can
+    std::unique_ptr<FrameExchange> exchange;
+    std::atomic<bool> stepping(true);
+    std::atomic<long> frames_rendered(0);
+    std::thread render_thread;
+    if (pipeline) {
+        exchange.reset(new FrameExchange(engine));
+        render_thread = std::thread([&] {
+            Canvas frame_canvas;
+            while (stepping.load(std::memory_order_acquire)) {
+                const WorldFrame* frame = exchange->take();
+                if (!frame) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                frame_canvas.refresh(*frame);
+                frames_rendered.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    FixedTimestep timestep(tick_rate);
+    int due = 0;
+    long batches = 0;
+
+    auto t1 = std::chrono::steady_clock::now();
+    for (long t = 0; t < ticks; t++) {
+        if (tick_rate > 0) {
+            // the time spent waiting counts, so ticks/sec is the rate achieved
+            while (!due) {
+                due = timestep.due();
+                if (!due) timestep.wait(std::chrono::seconds(1));
+                else batches++;
+            }
+            due--;
+        }
+        if (!replay_path.empty()) replay.apply(engine, brush);
+        if (edits_per_tick > 0) {
+            // a scripted load generator; edits go through the queue as they
+            // would from any other thread
+            auto e1 = std::chrono::steady_clock::now();
+            // keyed by the engine's tick, so a resumed run edits as the
+            // uninterrupted one would have
+            uint64_t key = tickKey(seed, engine.tick_count, EDIT_STREAM);
+            batch.clear();
+            for (int i = 0; i < edits_per_tick; i++) {
+                uint64_t r = randomAt(key, i);
+                int x = r % width, y = (r >> 16) % height;
+                int radius = (r >> 32) % 24;
+                ElementType e = ElementType((r >> 40) % ELEMENT_COUNT);
+                switch ((r >> 48) % 4) {
+                    case 0: batch.push_back(WorldEdit::stroke(x, y, x + int((r >> 52) % 64) - 32, y + int((r >> 58) % 64) - 32, radius, e)); break;
+                    case 1: batch.push_back(WorldEdit::rect(x, y, x + radius * 2, y + radius, e)); break;
+                    case 2: batch.push_back(WorldEdit::replace(x - 32, y - 32, x + 32, y + 32, e, ElementType((e + 1) % ELEMENT_COUNT))); break;
+                    case 3: batch.push_back(WorldEdit::stamp(x, y, image)); break;
+                }
+            }
+            edits.push(batch);
+            total_cells_edited += edits.apply(engine);
+            edit_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - e1).count();
+        }
+        if (store) {
+            auto p1 = std::chrono::steady_clock::now();
+            store->service();
+            page_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - p1).count();
+            peak_resident = std::max(peak_resident, store->residentBytes());
+            total_resident += store->residentBytes();
+        }
+        if (exchange) exchange->collect(engine);
+        engine.updateWorld();
+        if (exchange) exchange->publish(engine);
+        if (rewind) {
+            auto w1 = std::chrono::steady_clock::now();
+            rewind->record(engine);
+            rewind_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - w1).count();
+            if (rewind->last_keyframe) {
+                keyframe_bytes += rewind->last_bytes;
+                keyframes++;
+            } else {
+                delta_bytes += rewind->last_bytes;
+                delta_ticks++;
+            }
+        }
+        total_cells_visited += engine.cells_visited;
+        total_cells_updated += engine.cells_updated;
+        total_cells_moved += engine.cells_moved;
+        total_hot_chunks += engine.heat.hotChunks();
+        total_falling_bodies += engine.bodies.fallingCount();
+        if (std::find(hash_ticks.begin(), hash_ticks.end(), t + 1) != hash_ticks.end()) {
+            auto h1 = std::chrono::steady_clock::now();
+            std::cout << "hash at tick " << t + 1 << ": " << std::hex << engine.world.hash() << std::dec << "\n";
+            hash_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - h1).count();
+        }
+        if (render) {
+            auto r1 = std::chrono::steady_clock::now();
+            canvas.refresh(engine);
+            render_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - r1).count();
+            total_bytes_converted += canvas.bytes_converted;
+            total_regions += canvas.regions.size();
+        }
+    }
+    // what the journal recorded after its last step
+    if (!replay_path.empty()) replay.apply(engine, brush);
+    auto t2 = std::chrono::steady_clock::now();
+    stepping.store(false, std::memory_order_release);
+    if (render_thread.joinable()) render_thread.join();
+    double seconds = std::chrono::duration<double>(t2 - t1).count() - render_seconds - hash_seconds - edit_seconds - rewind_seconds - page_seconds;
+
+    // the directory keeps the map; the world comes back whole for the hash
+    int resident_regions = 0;
+    double flush_seconds = 0;
+    if (store) {
+        resident_regions = store->residentRegions();
+        auto f1 = std::chrono::steady_clock::now();
+        if (!store->flush()) return 1;
+        flush_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - f1).count();
+        store->loadAll();
+        if (store->failed) return 1;
+    }
+
+    if (!save_path.empty() && !saveSnapshot(engine, save_path)) return 1;
+#ifdef SAND_PROFILE
+    if (!trace_path.empty() && !Profiler::writeChromeTrace(trace_path)) return 1;
+    if (!csv_path.empty() && !Profiler::writeCsv(csv_path)) return 1;
+#endif
+
+    if (!replay_path.empty()) std::cout << "journal: " << replay_path << "\n";
+    else if (load_path.empty()) std::cout << "scenario: " << scenario->name << "\n";
+    else std::cout << "snapshot: " << load_path << " (loaded in " << load_seconds * 1000 << " ms)\n";
+    std::cout
+              << "world: " << width << "x" << height << "\n"
+              << "seed: " << seed << "\n"
+              << "threads: " << threads << "\n"
+              << "ticks: " << ticks << "\n"
+              << "elapsed: " << seconds << " s\n"
+              << "ticks/sec: " << ticks / seconds << "\n"
+              << "cell-updates/sec: " << total_cells_updated / seconds << "\n"
+              << "cells visited/tick: " << total_cells_visited / std::max(ticks, 1L) << "\n"
+              << "cells moved/tick: " << total_cells_moved / std::max(ticks, 1L) << "\n"
+              << "resident chunks: " << engine.world.allocatedChunks() << " of " << engine.chunks_width * engine.chunks_height << "\n"
+              << "memory: " << engine.world.memoryUsage() / 1024 << " KiB\n"
+              << "hot chunks/tick: " << total_hot_chunks / std::max(ticks, 1L) << "\n"
+              << "falling bodies/tick: " << total_falling_bodies / std::max(ticks, 1L) << "\n"
+              << "world hash: " << std::hex << engine.world.hash() << std::dec << "\n";
+    if (render) {
+        long frames = std::max(ticks, 1L);
+        std::cout << "render ms/frame: " << render_seconds * 1000 / frames << "\n"
+                  << "regions/frame: " << total_regions / frames << "\n"
+                  << "bytes converted/frame: " << total_bytes_converted / frames << "\n"
+                  << "bytes uploaded/frame: " << total_bytes_converted / frames
+                  << " (full frame " << 4L * width * height << ")\n";
+    }
+    if (edits_per_tick > 0) {
+        long frames = std::max(ticks, 1L);
+        std::cout << "edit ms/tick: " << edit_seconds * 1000 / frames << "\n"
+                  << "cells edited/tick: " << total_cells_edited / frames << "\n";
+    }
+    if (tick_rate > 0) {
+        std::cout << "target ticks/sec: " << tick_rate << "\n"
+                  << "ticks/batch: " << double(ticks) / std::max(batches, 1L) << "\n"
+                  << "dropped ticks: " << timestep.dropped << "\n";
+    }
+    if (rewind) {
+        long frames = std::max(ticks, 1L);
+        long oldest = rewind->oldestTick(), newest = rewind->newestTick();
+        std::cout << "rewind ms/tick: " << rewind_seconds * 1000 / frames << "\n"
+                  << "rewind bytes/tick: " << delta_bytes / std::max(delta_ticks, 1L)
+                  << " (keyframe " << keyframe_bytes / std::max(keyframes, 1L) << ")\n"
+                  << "rewind history: ticks " << oldest << ".." << newest << ", " << rewind->bytes() / 1024 << " KiB\n";
+        // after the stats above, since it changes the world
+        if (!rewind->empty()) {
+            auto s1 = std::chrono::steady_clock::now();
+            rewind->seek(engine, (oldest + newest) / 2);
+            double seek_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - s1).count();
+            std::cout << "rewind seek to tick " << (oldest + newest) / 2 << ": " << seek_seconds * 1000 << " ms\n";
+        }
+    }
+    if (store) {
+        long frames = std::max(ticks, 1L);
+        std::cout << "page ms/tick: " << page_seconds * 1000 / frames << "\n"
+                  << "resident regions: " << resident_regions << " of " << store->regions_width * store->regions_height << "\n"
+                  << "chunk memory/tick: " << long(total_resident / frames) / 1024 << " KiB, peak " << peak_resident / 1024
+                  << " (budget " << (size_t(page_budget_mb) << 20) / 1024 << ")\n"
+                  << "regions evicted: " << store->evictions << ", loaded: " << store->loads << "\n"
+                  << "page bytes written: " << store->bytes_written << ", read: " << store->bytes_read << "\n"
+                  << "held chunk-ticks: " << store->held_chunk_ticks << "\n"
+                  << "flush: " << flush_seconds * 1000 << " ms\n";
+        if (peak_resident > size_t(page_budget_mb) << 20) {
+            std::cerr << "warning: chunk memory peaked at " << peak_resident / 1024 << " KiB, over the page budget; "
+                      << "only idle regions are paged out\n";
+        }
+    }
+    if (pipeline) {
+        std::cout << "frames rendered: " << frames_rendered << " (" << frames_rendered / seconds << "/sec)\n";
+    }
+    if (!replay_path.empty()) {
+        std::cout << "hash checks: " << replay.hash_checks - replay.hash_mismatches << " of " << replay.hash_checks << " passed\n";
+        if (replay.hash_mismatches) return 2;
+    }
+    return 0;
+}
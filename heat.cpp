@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cstring>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "heat.h"
+#include "engine.h"
+#include "rng.h"
+#include "profiler.h"
+
+// Share of the difference to its 4 neighbours a tile takes on per step, below
+// 1/4 for the stencil to stay stable, and the share of its heat it keeps.
+static const float DIFFUSION = .2f;
+static const float RETAINED = .98f;
+// chunks whose tiles are all at most this far above ambient cool off to it
+static const float COLD = .5f;
+
+struct HeatTables {
+    uint8_t output[16];     // heat output of a cell, by material
+    float transition[16];   // temperature it changes at, 0 for never
+    uint8_t into[16];
+    uint16_t chance[16];    // out of REACTION_CERTAIN
+    float lowest;           // lowest transition temperature of any material
+};
+
+static constexpr HeatTables makeHeatTables() {
+    HeatTables tables = {};
+    tables.lowest = 1e30f;
+    for (int e = 0; e < ELEMENT_COUNT; e++) {
+        HeatRules rules = heatRules(ElementType(e));
+        tables.output[e] = rules.output;
+        tables.transition[e] = rules.transition;
+        tables.into[e] = rules.transition_into;
+        tables.chance[e] = reactionChance(rules.chance);
+        if (rules.transition) tables.lowest = std::min<float>(tables.lowest, rules.transition);
+    }
+    return tables;
+}
+
+static constexpr HeatTables HEAT = makeHeatTables();
+static_assert(ELEMENT_COUNT <= 16, "heat tables are looked up 16 cells at a time");
+
+HeatField::HeatField(int world_width, int world_height) :
+    tiles_width(world_width >> tile_shift),
+    tiles_height(world_height >> tile_shift),
+    chunks_width(world_width / World::chunk_size),
+    chunks_height(world_height / World::chunk_size),
+    stride(tiles_width + 2)
+{
+    tiles.assign(size_t(stride) * (tiles_height + 2), 0);
+    next = tiles;
+    hot.assign(chunks_width * chunks_height, 0);
+    marks.assign(chunks_width * chunks_height, 0);
+    step_count = 0;
+}
+
+void HeatField::reset() {
+    std::fill(tiles.begin(), tiles.end(), 0);
+    std::fill(hot.begin(), hot.end(), 0);
+    hot_chunks.clear();
+}
+
+void HeatField::add(int chunk) {
+    if (marks[chunk] == step_count) return;
+    marks[chunk] = step_count;
+    stepped.push_back(chunk);
+}
+
+// heat output of each of the 16 tiles of a chunk, row by row
+static void chunkSources(const World& world, int xx, int yy, float out[16]) {
+    const World::Chunk* chunk = world.chunkAt(xx, yy);
+    if (!chunk) {
+        std::fill(out, out + 16, float(HEAT.output[world.fillAt(xx, yy)] * HeatField::tile_size * HeatField::tile_size));
+        return;
+    }
+    for (int ty = 0; ty < HeatField::chunk_tiles; ty++) {
+        const ElementType* rows = chunk->matrix + ty * HeatField::tile_size * World::chunk_size;
+#if defined(__SSSE3__)
+        // look the outputs up 16 cells at a time, add up the tile's 4 rows,
+        // then each tile's 4 columns
+        const __m128i table = _mm_loadu_si128((const __m128i*) HEAT.output);
+        __m128i sum = _mm_setzero_si128();
+        for (int y = 0; y < HeatField::tile_size; y++) {
+            __m128i materials = _mm_loadu_si128((const __m128i*) (rows + y * World::chunk_size));
+            sum = _mm_add_epi8(sum, _mm_shuffle_epi8(table, materials));
+        }
+        __m128i pairs = _mm_maddubs_epi16(sum, _mm_set1_epi8(1));
+        __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi16(1));
+        _mm_storeu_ps(out + ty * HeatField::chunk_tiles, _mm_cvtepi32_ps(quads));
+#else
+        for (int tx = 0; tx < HeatField::chunk_tiles; tx++) {
+            int sum = 0;
+            for (int y = 0; y < HeatField::tile_size; y++) {
+                for (int x = 0; x < HeatField::tile_size; x++) sum += HEAT.output[rows[y * World::chunk_size + tx * HeatField::tile_size + x]];
+            }
+            out[ty * HeatField::chunk_tiles + tx] = sum;
+        }
+#endif
+    }
+}
+
+void HeatField::step(Engine& engine) {
+    PROFILE_SCOPE("heat");
+    step_count++;
+    stepped.clear();
+    // hot chunks and their neighbours, which they heat up, and the chunks the
+    // tick touched, which may hold new sources
+    for (int chunk : hot_chunks) {
+        int xx = chunk % chunks_width, yy = chunk / chunks_width;
+        add(chunk);
+        if (xx > 0) add(chunk - 1);
+        if (xx < chunks_width - 1) add(chunk + 1);
+        if (yy > 0) add(chunk - chunks_width);
+        if (yy < chunks_height - 1) add(chunk + chunks_width);
+    }
+    for (int chunk : engine.touchedChunks()) add(chunk);
+
+    sources.resize(stepped.size() * 16);
+    still_hot.resize(stepped.size());
+    heat_key = tickKey(engine.rngSeed(), engine.tick_count, HEAT_STREAM);
+    engine.thread_pool.parallelFor(stepped.size(), [this, &engine] (int task, int /*thread*/) {
+        stepChunk(engine, task);
+    });
+
+    // every stepped chunk read the old tiles, so they are only replaced now
+    hot_chunks.clear();
+    for (size_t task = 0; task < stepped.size(); task++) {
+        int chunk = stepped[task];
+        int xx = chunk % chunks_width, yy = chunk / chunks_width;
+        for (int ty = 0; ty < chunk_tiles; ty++) {
+            int index = tileIndex(xx * chunk_tiles, yy * chunk_tiles + ty);
+            std::memcpy(&tiles[index], &next[index], chunk_tiles * sizeof(float));
+        }
+        hot[chunk] = still_hot[task];
+        if (still_hot[task]) hot_chunks.push_back(chunk);
+    }
+    // the same chunks in the same order whatever the thread count
+    std::sort(hot_chunks.begin(), hot_chunks.end());
+    PROFILE_COUNTER("hot chunks", hot_chunks.size());
+    PROFILE_COUNTER("heat chunks stepped", stepped.size());
+}
+
+void HeatField::stepChunk(Engine& engine, int task) {
+    World& world = engine.world;
+    const int chunk = stepped[task];
+    const int xx = chunk % chunks_width, yy = chunk / chunks_width;
+    float* source = &sources[task * 16];
+    chunkSources(world, xx, yy, source);
+
+    float hottest = 0;
+    for (int ty = 0; ty < chunk_tiles; ty++) {
+        int index = tileIndex(xx * chunk_tiles, yy * chunk_tiles + ty);
+        const float* row = &tiles[index];
+#if defined(__SSE2__)
+        __m128 c = _mm_loadu_ps(row);
+        __m128 neighbours = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row - 1), _mm_loadu_ps(row + 1)),
+                                       _mm_add_ps(_mm_loadu_ps(row - stride), _mm_loadu_ps(row + stride)));
+        __m128 flow = _mm_sub_ps(neighbours, _mm_mul_ps(_mm_set1_ps(4), c));
+        __m128 t = _mm_add_ps(_mm_mul_ps(_mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(DIFFUSION), flow)), _mm_set1_ps(RETAINED)),
+                              _mm_loadu_ps(source + ty * chunk_tiles));
+        _mm_storeu_ps(&next[index], t);
+        __m128 m = _mm_max_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        hottest = std::max(hottest, _mm_cvtss_f32(m));
+#else
+        for (int tx = 0; tx < chunk_tiles; tx++) {
+            float c = row[tx];
+            float neighbours = (row[tx - 1] + row[tx + 1]) + (row[tx - stride] + row[tx + stride]);
+            float t = (c + DIFFUSION * (neighbours - 4 * c)) * RETAINED + source[ty * chunk_tiles + tx];
+            next[index + tx] = t;
+            hottest = std::max(hottest, t);
+        }
+#endif
+    }
+
+    still_hot[task] = hottest > COLD;
+    if (!still_hot[task]) {
+        for (int ty = 0; ty < chunk_tiles; ty++) {
+            std::fill_n(&next[tileIndex(xx * chunk_tiles, yy * chunk_tiles + ty)], chunk_tiles, 0.f);
+        }
+        return;
+    }
+    if (hottest < HEAT.lowest) return;
+
+    // transitions, only in tiles hot enough for any
+    DirtyBox changed;
+    World::Chunk* target = world.chunkAt(xx, yy);
+    for (int t = 0; t < 16; t++) {
+        int tx = xx * chunk_tiles + t % chunk_tiles, ty = yy * chunk_tiles + t / chunk_tiles;
+        float temperature = next[tileIndex(tx, ty)];
+        if (temperature < HEAT.lowest) continue;
+        for (int y = ty * tile_size; y < (ty + 1) * tile_size; y++) {
+            for (int x = tx * tile_size; x < (tx + 1) * tile_size; x++) {
+                ElementType e = target ? target->matrix[World::localIndex(x, y)] : world.fillAt(xx, yy);
+                if (!HEAT.transition[e] || temperature < HEAT.transition[e]) continue;
+                if ((randomAt(heat_key, x + y * world.width) & (REACTION_CERTAIN - 1)) >= HEAT.chance[e]) continue;
+                if (!target) target = world.materialize(xx, yy);
+                target->matrix[World::localIndex(x, y)] = ElementType(HEAT.into[e]);
+                target->speeds[World::localIndex(x, y)] = 0;
+                changed.include(x, y);
+            }
+        }
+    }
+    if (changed.empty()) return;
+    world.unsettle(changed.min_x - 1, changed.min_y - 1, changed.max_x + 1, changed.max_y + 1);
+    engine.markDirtyBox(changed);
+}
+
+void HeatField::read(std::vector<float>& out) const {
+    out.resize(size_t(tiles_width) * tiles_height);
+    for (int ty = 0; ty < tiles_height; ty++) {
+        std::memcpy(&out[size_t(ty) * tiles_width], &tiles[tileIndex(0, ty)], tiles_width * sizeof(float));
+    }
+}
+
+void HeatField::write(const std::vector<float>& in) {
+    reset();
+    for (int ty = 0; ty < tiles_height; ty++) {
+        std::memcpy(&tiles[tileIndex(0, ty)], &in[size_t(ty) * tiles_width], tiles_width * sizeof(float));
+    }
+    // hot chunks are exactly the ones with a tile above ambient
+    for (int yy = 0; yy < chunks_height; yy++) {
+        for (int xx = 0; xx < chunks_width; xx++) {
+            for (int t = 0; t < 16 && !hot[xx + yy * chunks_width]; t++) {
+                if (tiles[tileIndex(xx * chunk_tiles + t % chunk_tiles, yy * chunk_tiles + t / chunk_tiles)] != 0) hot[xx + yy * chunks_width] = 1;
+            }
+            if (hot[xx + yy * chunks_width]) hot_chunks.push_back(xx + yy * chunks_width);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "world.h"
+
+class Engine;
+
+// Temperatures, in degrees above ambient, on a grid of 4x4 cell tiles, so a
+// chunk is 4x4 tiles and one row of them fills an SSE register. Every tick
+// the engine runs a step of it after the chunks updated:
+//
+//   - cells of materials with a heat output (fire, lava) add it to their tile
+//   - the tiles diffuse into their 4 neighbours and lose a little to ambient
+//   - materials with a transition (water boiling, wood and gas igniting, sand
+//     melting) roll it in tiles at least that hot, and change like edits do
+//
+// Only hot chunks, ones with a tile above ambient, and the chunks next to them
+// are stepped; a chunk cooling off is zeroed, so every other tile is ambient
+// and the cost follows the hot area rather than the world size. Chunks the
+// engine changed are searched for new heat sources as well.
+class HeatField {
+public:
+    const static int tile_shift = 2;
+    const static int tile_size = 1 << tile_shift;
+    const static int chunk_tiles = World::chunk_size / tile_size; // per side
+    static_assert(chunk_tiles == 4, "a row of a chunk's tiles is one SSE register of floats");
+
+    const int tiles_width;
+    const int tiles_height;
+    const int chunks_width;
+    const int chunks_height;
+
+    HeatField(int world_width, int world_height);
+
+    void reset(); // ambient everywhere
+    // temperature of the tile holding cell (x, y)
+    float at(int x, int y) const { return tiles[tileIndex(x >> tile_shift, y >> tile_shift)]; }
+    int hotChunks() const { return hot_chunks.size(); }
+    bool isHot(int chunk) const { return hot[chunk]; } // by index
+    const std::vector<int>& hotChunkIndices() const { return hot_chunks; }
+
+    // called by Engine::updateWorld, after the chunks of the tick updated
+    void step(Engine& engine);
+
+    // for snapshots: every tile in row order, and setting them back
+    void read(std::vector<float>& out) const;
+    void write(const std::vector<float>& in);
+
+private:
+    // Tiles are stored row by row with a border of one tile kept at ambient,
+    // so the stencil reads its neighbours without checking for the edge.
+    std::vector<float> tiles;
+    std::vector<float> next;
+    int stride;
+
+    std::vector<uint8_t> hot;        // per chunk: has a tile above ambient
+    std::vector<int> hot_chunks;     // indices of the hot chunks
+    std::vector<int> stepped;        // chunks stepped this tick
+    std::vector<uint32_t> marks;     // per chunk, step it was last added to stepped in
+    std::vector<float> sources;      // per stepped chunk, the heat output of its tiles
+    std::vector<uint8_t> still_hot;  // per stepped chunk, the outcome of its step
+    uint32_t step_count;
+    uint64_t heat_key; // tickKey() of HEAT_STREAM for the current step
+
+    int tileIndex(int tx, int ty) const { return (ty + 1) * stride + tx + 1; }
+    void add(int chunk);
+    void stepChunk(Engine& engine, int task);
+};
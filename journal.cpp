@@ -0,0 +1,226 @@
+#include <cstring>
+#include <iostream>
+#include "journal.h"
+
+static const char JOURNAL_MAGIC[4] = { 'F', 'S', 'J', 'N' };
+static const size_t JOURNAL_HEADER_SIZE = 4 + 3 * 4 + 8;
+
+// signed values are zigzag encoded so small negatives stay small
+static uint64_t zigzag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+static int64_t unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+
+JournalWriter::JournalWriter() {
+    steps = 0;
+    last_record_step = 0;
+}
+
+JournalWriter::~JournalWriter() {
+    close();
+}
+
+bool JournalWriter::open(const std::string& path, int width, int height, uint64_t seed) {
+    file.open(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "can't open " << path << " for writing" << std::endl;
+        return false;
+    }
+    uint32_t header[3] = { JOURNAL_VERSION, uint32_t(width), uint32_t(height) };
+    file.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    file.write((const char*) header, sizeof(header));
+    file.write((const char*) &seed, sizeof(seed));
+    steps = 0;
+    last_record_step = 0;
+    return true;
+}
+
+void JournalWriter::close() {
+    if (!isOpen()) return;
+    record(JOURNAL_END);
+    file.close();
+}
+
+void JournalWriter::element(ElementType e) {
+    if (!isOpen()) return;
+    record(JOURNAL_ELEMENT);
+    file.put(e);
+}
+
+void JournalWriter::radius(int radius) {
+    if (!isOpen()) return;
+    record(JOURNAL_RADIUS);
+    varint(radius);
+}
+
+void JournalWriter::stroke(int x1, int y1, int x2, int y2) {
+    if (!isOpen()) return;
+    record(JOURNAL_STROKE);
+    varint(zigzag(x1));
+    varint(zigzag(y1));
+    varint(zigzag(x2));
+    varint(zigzag(y2));
+}
+
+void JournalWriter::reset() {
+    if (!isOpen()) return;
+    record(JOURNAL_RESET);
+}
+
+void JournalWriter::hash(uint64_t hash) {
+    if (!isOpen()) return;
+    record(JOURNAL_HASH);
+    file.write((const char*) &hash, sizeof(hash));
+}
+
+void JournalWriter::step() {
+    steps++;
+}
+
+void JournalWriter::record(JournalEvent event) {
+    file.put(event);
+    varint(steps - last_record_step);
+    last_record_step = steps;
+}
+
+void JournalWriter::varint(uint64_t value) {
+    while (value >= 0x80) {
+        file.put(char(value | 0x80));
+        value >>= 7;
+    }
+    file.put(char(value));
+}
+
+JournalReplay::JournalReplay() {
+    width = 0;
+    height = 0;
+    seed = 0;
+    steps = 0;
+    step_count = 0;
+    hash_checks = 0;
+    hash_mismatches = 0;
+    position = 0;
+    next = Record {};
+}
+
+bool JournalReplay::open(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "can't open " << path << std::endl;
+        return false;
+    }
+    data.resize(file.tellg());
+    file.seekg(0);
+    file.read((char*) data.data(), data.size());
+
+    uint32_t header[3];
+    if (data.size() < JOURNAL_HEADER_SIZE || std::memcmp(data.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC))) {
+        std::cerr << path << " is not a journal" << std::endl;
+        return false;
+    }
+    std::memcpy(header, data.data() + 4, sizeof(header));
+    std::memcpy(&seed, data.data() + 4 + sizeof(header), sizeof(seed));
+    if (header[0] != JOURNAL_VERSION) {
+        std::cerr << path << " is journal version " << header[0] << ", expected " << JOURNAL_VERSION << std::endl;
+        return false;
+    }
+    width = header[1];
+    height = header[2];
+
+    // walk every record up front, so a replay never stops halfway through a
+    // broken journal, and to learn its length
+    position = JOURNAL_HEADER_SIZE;
+    Record record = {};
+    do {
+        if (!readRecord(record, record.step)) {
+            std::cerr << path << " is corrupt" << std::endl;
+            return false;
+        }
+    } while (record.event != JOURNAL_END);
+    steps = record.step;
+
+    position = JOURNAL_HEADER_SIZE;
+    step_count = 0;
+    readRecord(next, 0);
+    return true;
+}
+
+bool JournalReplay::apply(Engine& engine, Brush& brush) {
+    while (next.step == step_count && next.event != JOURNAL_END) {
+        switch (next.event) {
+            case JOURNAL_ELEMENT:
+                brush.element = ElementType(next.values[0]);
+                break;
+            case JOURNAL_RADIUS:
+                brush.radius = next.values[0];
+                break;
+            case JOURNAL_STROKE:
+                paintStroke(engine, brush, next.values[0], next.values[1], next.values[2], next.values[3]);
+                break;
+            case JOURNAL_RESET:
+                engine.reset();
+                break;
+            case JOURNAL_HASH: {
+                uint64_t hash = engine.world.hash();
+                hash_checks++;
+                if (hash != next.hash) {
+                    hash_mismatches++;
+                    std::cerr << "hash mismatch at step " << step_count << ": " << std::hex << hash
+                              << ", recorded " << next.hash << std::dec << std::endl;
+                }
+                break;
+            }
+            case JOURNAL_END:
+                break; // never reached, the loop stops at it
+        }
+        readRecord(next, next.step);
+    }
+    // what was recorded after the last step is applied, but not stepped past
+    if (next.event == JOURNAL_END && next.step == step_count) return false;
+    step_count++;
+    return true;
+}
+
+bool JournalReplay::readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (position >= data.size()) return false;
+        uint8_t byte = data[position++];
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool JournalReplay::readRecord(Record& record, uint32_t previous_step) {
+    uint64_t delta;
+    if (position >= data.size()) return false;
+    record.event = JournalEvent(data[position++]);
+    if (!readVarint(delta)) return false;
+    record.step = previous_step + delta;
+
+    uint64_t value;
+    switch (record.event) {
+        case JOURNAL_ELEMENT:
+            if (position >= data.size() || data[position] >= ELEMENT_COUNT) return false;
+            record.values[0] = data[position++];
+            return true;
+        case JOURNAL_RADIUS:
+            if (!readVarint(value)) return false;
+            record.values[0] = value;
+            return true;
+        case JOURNAL_STROKE:
+            for (int i = 0; i < 4; i++) {
+                if (!readVarint(value)) return false;
+                record.values[i] = unzigzag(value);
+            }
+            return true;
+        case JOURNAL_HASH:
+            if (data.size() - position < sizeof(record.hash)) return false;
+            std::memcpy(&record.hash, data.data() + position, sizeof(record.hash));
+            position += sizeof(record.hash);
+            return true;
+        case JOURNAL_RESET:
+        case JOURNAL_END:
+            return true;
+    }
+    return false; // unknown event
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "engine.h"
+#include "edit.h"
+
+// Input journals record what the player did, step by step, so a session can
+// be replayed bit exactly: headless for A/B performance runs between builds,
+// or in the window. A step is one Engine::updateWorld(); the events of a step
+// are whatever happened to the world since the previous one.
+//
+// Layout: magic "FSJN", version (u32), width (u32), height (u32), seed (u64),
+// then records of an event type (u8), the steps since the previous record
+// (varint) and the event's payload:
+//   ELEMENT  the brush material (u8)
+//   RADIUS   the brush radius (varint)
+//   STROKE   x1, y1, x2, y2 in world coordinates (zigzag varints)
+//   RESET    nothing
+//   HASH     World::hash() at this point (u64), checked on replay
+//   END      nothing, closes the journal at its final step
+// A session always starts from an empty world. Strokes are painted as
+// capsules since version 2; version 1 painted a chain of circles, which
+// replays can't reproduce any more.
+const uint32_t JOURNAL_VERSION = 2;
+
+enum JournalEvent : uint8_t {
+    JOURNAL_ELEMENT,
+    JOURNAL_RADIUS,
+    JOURNAL_STROKE,
+    JOURNAL_RESET,
+    JOURNAL_HASH,
+    JOURNAL_END,
+};
+
+class JournalWriter {
+public:
+    JournalWriter();
+    ~JournalWriter();
+
+    bool open(const std::string& path, int width, int height, uint64_t seed);
+    bool isOpen() const { return file.is_open(); }
+    void close(); // writes the END record
+
+    void element(ElementType e);
+    void radius(int radius);
+    void stroke(int x1, int y1, int x2, int y2);
+    void reset();
+    void hash(uint64_t hash);
+    void step(); // after every updateWorld()
+
+private:
+    std::ofstream file;
+    uint32_t steps;
+    uint32_t last_record_step;
+
+    void record(JournalEvent event);
+    void varint(uint64_t value);
+};
+
+class JournalReplay {
+public:
+    int width;
+    int height;
+    uint64_t seed;
+    uint32_t steps;      // length of the journal, in updateWorld() calls
+    uint32_t step_count; // steps replayed so far
+    int hash_checks;
+    int hash_mismatches;
+
+    JournalReplay();
+
+    // reads the whole journal; false, after printing why, if it can't be used
+    bool open(const std::string& path);
+
+    // applies the events of the next step to the engine and the brush, then
+    // returns true if updateWorld() should run for it, or false once the
+    // journal has ended:
+    //     while (replay.apply(engine, brush)) engine.updateWorld();
+    bool apply(Engine& engine, Brush& brush);
+
+private:
+    struct Record {
+        JournalEvent event;
+        uint32_t step;
+        int64_t values[4];
+        uint64_t hash;
+    };
+
+    std::vector<uint8_t> data;
+    size_t position;
+    Record next; // the first record not applied yet
+
+    bool readVarint(uint64_t& value);
+    bool readRecord(Record& record, uint32_t previous_step);
+};
@@ -1,10 +1,57 @@
 #include <SFML/Graphics.hpp>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
 #include "simulation.h"
+#include "journal.h"
 #include "constants.h"
 
-int main() {
-    Simulation simulation(1280, 720);
+// usage: fallingSand [world_width world_height] [--record PATH | --replay PATH] [--tick-rate N]
+int main(int argc, char** argv) {
+    int world_width = WIDTH;
+    int world_height = HEIGHT;
+    std::string record_path;
+    std::string replay_path;
+    int tick_rate = TICK_RATE;
+    int sizes = 0;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--record") && has_value) {
+            record_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && has_value) {
+            replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--tick-rate") && has_value) {
+            tick_rate = std::atoi(argv[++i]);
+        } else if (sizes < 2) {
+            (sizes++ ? world_height : world_width) = std::atoi(argv[i]);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [world_width world_height] [--record PATH | --replay PATH] [--tick-rate N]" << std::endl;
+            return 1;
+        }
+    }
+
+    // a replay brings its own world size
+    JournalReplay replay;
+    if (!replay_path.empty()) {
+        if (!replay.open(replay_path)) return 1;
+        world_width = replay.width;
+        world_height = replay.height;
+    }
+    if (world_width <= 0 || world_height <= 0 || world_width % Engine::chunk_size || world_height % Engine::chunk_size) {
+        std::cerr << "world dimensions must be positive multiples of " << Engine::chunk_size << std::endl;
+        return 1;
+    }
+    if (tick_rate < 0) {
+        std::cerr << "tick rate must be 0 (unlimited) or positive" << std::endl;
+        return 1;
+    }
+
+    Simulation simulation(1280, 720, world_width, world_height);
+    if (!replay_path.empty()) simulation.replay(&replay);
+    else if (!record_path.empty()) simulation.record(record_path);
+    // replays always run at full speed
+    if (replay_path.empty() && tick_rate != TICK_RATE) simulation.setTickRate(tick_rate);
     simulation.run();
     return 0;
 }
@@ -0,0 +1,83 @@
+#ifdef SAND_PROFILE
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "profiler.h"
+
+static ProfileEvent events[Profiler::capacity];
+static std::atomic<uint64_t> event_count(0);
+static std::atomic<int> thread_count(0);
+static const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+uint64_t Profiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+int Profiler::threadId() {
+    thread_local int id = thread_count.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+void Profiler::record(const ProfileEvent& event) {
+    // every event gets its own slot, wrapping onto the oldest
+    events[event_count.fetch_add(1, std::memory_order_relaxed) % capacity] = event;
+}
+
+void Profiler::counter(const char* name, int64_t value, int thread) {
+    record(ProfileEvent { name, now(), 0, value, thread, true });
+}
+
+// calls f on the buffered events, oldest first
+template <typename F>
+static void forEachEvent(F f) {
+    uint64_t end = event_count.load(std::memory_order_acquire);
+    uint64_t begin = end > Profiler::capacity ? end - Profiler::capacity : 0;
+    for (uint64_t i = begin; i < end; i++) f(events[i % Profiler::capacity]);
+}
+
+bool Profiler::writeChromeTrace(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "can't open " << path << " for writing" << std::endl;
+        return false;
+    }
+    // timestamps are in microseconds. Counters are per process in the trace
+    // format, so per thread counters carry the thread in their name.
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    bool first = true;
+    forEachEvent([&] (const ProfileEvent& event) {
+        file << (first ? "" : ",\n");
+        first = false;
+        if (event.counter) {
+            file << "{\"name\":\"" << event.name;
+            if (event.thread >= 0) file << " (thread " << event.thread << ")";
+            file << "\",\"ph\":\"C\",\"ts\":" << event.start / 1000.0 << ",\"pid\":0,\"args\":{\"value\":" << event.value << "}}";
+        } else {
+            file << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"ts\":" << event.start / 1000.0
+                 << ",\"dur\":" << event.duration / 1000.0 << ",\"pid\":0,\"tid\":" << event.thread << "}";
+        }
+    });
+    file << "\n]}\n";
+    return bool(file);
+}
+
+bool Profiler::writeCsv(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "can't open " << path << " for writing" << std::endl;
+        return false;
+    }
+    file << std::fixed << std::setprecision(3) << "kind,name,thread,start_us,duration_us,value\n";
+    forEachEvent([&] (const ProfileEvent& event) {
+        file << (event.counter ? "counter," : "scope,") << event.name << ",";
+        if (event.thread >= 0) file << event.thread;
+        file << "," << event.start / 1000.0 << ",";
+        if (event.counter) file << "," << event.value << "\n";
+        else file << event.duration / 1000.0 << ",\n";
+    });
+    return bool(file);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+// Frame instrumentation: scoped timers and counters recorded into a fixed size
+// ring buffer, which can be dumped as Chrome trace JSON (chrome://tracing or
+// ui.perfetto.dev) or as CSV. Only compiled in with -DSAND_PROFILE
+// (PROFILE=1 ./build.sh); otherwise the macros expand to nothing, their
+// arguments are never evaluated and the hot loops pay nothing.
+//
+//     PROFILE_SCOPE("renderWorld");            // times the enclosing scope
+//     PROFILE_COUNTER("cells visited", count); // samples a value
+//     PROFILE_THREAD_COUNTER("busy ns", ns, t); // samples a value of thread t
+//
+// Names must be string literals, only the pointer is stored.
+
+#ifdef SAND_PROFILE
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t start;    // ns since the profiler started
+    uint64_t duration; // ns, scopes only
+    int64_t value;     // counters only
+    int thread;        // -1 for counters of the whole process
+    bool counter;
+};
+
+class Profiler {
+public:
+    const static int capacity = 1 << 16; // events kept, older ones are overwritten
+
+    static uint64_t now();
+    // small id of the calling thread, in the order threads first record
+    static int threadId();
+
+    // safe to call from any thread
+    static void record(const ProfileEvent& event);
+    // thread only labels the counter, e.g. with a thread pool index; -1 for
+    // counters of the whole process
+    static void counter(const char* name, int64_t value, int thread = -1);
+
+    // write what the ring buffer holds, oldest first; only while nothing records
+    static bool writeChromeTrace(const std::string& path);
+    static bool writeCsv(const std::string& path);
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name) : name(name), start(Profiler::now()) {}
+    ~ProfileScope() { Profiler::record(ProfileEvent { name, start, Profiler::now() - start, 0, Profiler::threadId(), false }); }
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::counter(name, value)
+#define PROFILE_THREAD_COUNTER(name, value, thread) Profiler::counter(name, value, thread)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void) 0)
+#define PROFILE_COUNTER(name, value) ((void) 0)
+#define PROFILE_THREAD_COUNTER(name, value, thread) ((void) 0)
+
+#endif
@@ -0,0 +1,614 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include "regionStore.h"
+#include "chunkRecords.h"
+#include "snapshot.h"
+#include "profiler.h"
+
+static const char REGION_MAGIC[4] = { 'F', 'S', 'R', 'G' };
+static const char MANIFEST_MAGIC[4] = { 'F', 'S', 'R', 'S' };
+static const uint32_t REGION_VERSION = 3;
+static const DirtyRect EMPTY_RECT = { 255, 255, 0, 0 };
+
+struct RegionHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t region_chunks;
+};
+
+// what a directory holds a map of
+struct ManifestHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t chunk_size;
+    uint32_t region_chunks;
+};
+
+static const int region_area = RegionStore::region_chunks * RegionStore::region_chunks;
+
+template <typename T>
+static void append(std::vector<uint8_t>& data, const T& value) {
+    data.insert(data.end(), (const uint8_t*) &value, (const uint8_t*) &value + sizeof(value));
+}
+
+bool RegionStore::writeRegion(const std::string& path, const RegionImage& image, size_t& bytes) {
+    std::vector<uint8_t> data;
+    RegionHeader header = {};
+    std::memcpy(header.magic, REGION_MAGIC, sizeof(header.magic));
+    header.version = REGION_VERSION;
+    header.chunk_size = World::chunk_size;
+    header.region_chunks = region_chunks;
+    append(data, header);
+
+    uint8_t record[MAX_CHUNK_RECORD];
+    for (const ChunkImage& chunk : image) {
+        append(data, chunk.rect);
+        size_t size = chunk.fill != NULL_ELEMENT ? writeFill(chunk.fill, record) : writeChunk(chunk.matrix, chunk.settled, chunk.speeds, record);
+        data.insert(data.end(), record, record + size);
+    }
+
+    // a crash mid-write leaves the previous file whole
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    if (!file.write((const char*) data.data(), data.size()) || (file.close(), !file)) {
+        std::cerr << "failed writing " << temporary << std::endl;
+        return false;
+    }
+    if (std::rename(temporary.c_str(), path.c_str())) {
+        std::cerr << "can't rename " << temporary << " to " << path << std::endl;
+        return false;
+    }
+    bytes = data.size();
+    return true;
+}
+
+bool RegionStore::readRegion(const std::string& path, RegionImage& image, size_t& bytes) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "can't open " << path << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data(file.tellg());
+    file.seekg(0);
+    if (!file.read((char*) data.data(), data.size())) {
+        std::cerr << "failed reading " << path << std::endl;
+        return false;
+    }
+    bytes = data.size();
+
+    RegionHeader header;
+    if (data.size() < sizeof(header) || (std::memcpy(&header, data.data(), sizeof(header)), std::memcmp(header.magic, REGION_MAGIC, sizeof(header.magic)))) {
+        std::cerr << path << " is not a region" << std::endl;
+        return false;
+    }
+    if (header.version > REGION_VERSION || header.chunk_size != World::chunk_size || header.region_chunks != region_chunks) {
+        std::cerr << path << " is region version " << header.version << " of " << header.region_chunks << "x" << header.region_chunks
+                  << " chunks of " << header.chunk_size << " cells, expected " << REGION_VERSION << " of " << region_chunks << "x"
+                  << region_chunks << " chunks of " << World::chunk_size << " cells" << std::endl;
+        return false;
+    }
+
+    const uint8_t* at = data.data() + sizeof(header);
+    const uint8_t* end = data.data() + data.size();
+    image.resize(region_area);
+    for (ChunkImage& chunk : image) {
+        // nothing was pending in the regions of older stores
+        chunk.rect = EMPTY_RECT;
+        bool ok = true;
+        if (header.version >= 2) {
+            ok = end - at >= (long) sizeof(chunk.rect);
+            if (ok) std::memcpy(&chunk.rect, at, sizeof(chunk.rect));
+            at += sizeof(chunk.rect);
+            ok = ok && (chunk.rect.empty() || (chunk.rect.max_x < World::chunk_size && chunk.rect.max_y < World::chunk_size));
+        }
+        ok = ok && end - at >= 2;
+        if (ok && at[0] == FILL_ENCODING) {
+            chunk.fill = ElementType(at[1]);
+            ok = chunk.fill < ELEMENT_COUNT;
+            at += 2;
+        } else if (ok) {
+            chunk.fill = NULL_ELEMENT;
+            const uint8_t encoding = *at++;
+            ok = readMaterials(at, end, encoding, chunk.matrix);
+        }
+        if (ok && chunk.fill == NULL_ELEMENT) {
+            ok = end - at >= (long) sizeof(chunk.settled);
+            if (ok) std::memcpy(chunk.settled, at, sizeof(chunk.settled));
+            at += sizeof(chunk.settled);
+            ok = ok && readRuns(at, end, MAX_SPEED + 1, chunk.speeds);
+        }
+        if (!ok) {
+            std::cerr << path << " is corrupt" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+RegionStore::RegionStore(Engine& engine, const std::string& directory, size_t budget_bytes) :
+    regions_width((engine.chunks_width + region_chunks - 1) / region_chunks),
+    regions_height((engine.chunks_height + region_chunks - 1) / region_chunks),
+    engine(engine),
+    directory(directory),
+    budget(budget_bytes),
+    states(regions_width * regions_height, RESIDENT),
+    changed(regions_width * regions_height, 1),
+    last_used(regions_width * regions_height, 0),
+    held(engine.chunks_width * engine.chunks_height, 0),
+    running(false)
+{
+    loads = 0;
+    evictions = 0;
+    held_chunk_ticks = 0;
+    bytes_written = 0;
+    bytes_read = 0;
+    failed = false;
+    services = 0;
+    in_flight = 0;
+}
+
+RegionStore::~RegionStore() {
+    if (!running.load(std::memory_order_relaxed)) return;
+    drain(true);
+    running.store(false, std::memory_order_release);
+    io.join();
+    engine.held_chunks = nullptr;
+}
+
+std::string RegionStore::regionPath(int region) const {
+    return directory + "/" + std::to_string(region % regions_width) + "_" + std::to_string(region / regions_width) + ".fsrg";
+}
+
+static std::string manifestPath(const std::string& directory) {
+    return directory + "/world.fsrs";
+}
+
+bool RegionStore::holdsMap(const std::string& directory) {
+    return std::filesystem::exists(manifestPath(directory));
+}
+
+int RegionStore::regionOf(int chunk) const {
+    return chunk % engine.chunks_width / region_chunks + chunk / engine.chunks_width / region_chunks * regions_width;
+}
+
+bool RegionStore::writeManifest(const std::vector<int>& active) const {
+    ManifestHeader header = {};
+    std::memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = REGION_VERSION;
+    header.width = engine.world.width;
+    header.height = engine.world.height;
+    header.chunk_size = World::chunk_size;
+    header.region_chunks = region_chunks;
+    std::vector<uint8_t> data;
+    append(data, header);
+    append(data, uint32_t(active.size()));
+    for (int region : active) append(data, uint32_t(region));
+    append(data, int64_t(engine.tick_count));
+    append(data, uint64_t(engine.rngSeed()));
+    writeHeat(engine, data);
+    writeMotions(engine, data);
+
+    const std::string path = manifestPath(directory);
+    const std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary);
+    if (!file.write((const char*) data.data(), data.size()) || (file.close(), !file)) {
+        std::cerr << "failed writing " << temporary << std::endl;
+        return false;
+    }
+    if (std::rename(temporary.c_str(), path.c_str())) {
+        std::cerr << "can't rename " << temporary << " to " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool RegionStore::open() {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cerr << "can't create " << directory << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    ManifestHeader expected = {};
+    std::memcpy(expected.magic, MANIFEST_MAGIC, sizeof(expected.magic));
+    expected.version = REGION_VERSION;
+    expected.width = engine.world.width;
+    expected.height = engine.world.height;
+    expected.chunk_size = World::chunk_size;
+    expected.region_chunks = region_chunks;
+
+    const std::string manifest_path = manifestPath(directory);
+    std::vector<int> active; // regions to read in right away
+    std::ifstream manifest(manifest_path, std::ios::binary);
+    if (manifest) {
+        ManifestHeader header;
+        if (!manifest.read((char*) &header, sizeof(header)) || std::memcmp(header.magic, MANIFEST_MAGIC, sizeof(header.magic))) {
+            std::cerr << manifest_path << " is not a region store manifest" << std::endl;
+            return false;
+        }
+        if (header.version > REGION_VERSION) {
+            std::cerr << manifest_path << " is version " << header.version << ", expected " << REGION_VERSION << " or older" << std::endl;
+            return false;
+        }
+        expected.version = header.version;
+        if (std::memcmp(&header, &expected, sizeof(header))) {
+            std::cerr << directory << " holds a " << header.width << "x" << header.height << " world in regions of "
+                      << header.region_chunks << "x" << header.region_chunks << " chunks of " << header.chunk_size << " cells, expected "
+                      << expected.width << "x" << expected.height << " in regions of " << region_chunks << "x" << region_chunks
+                      << " chunks of " << World::chunk_size << " cells" << std::endl;
+            return false;
+        }
+        if (header.version >= 2) {
+            uint32_t count;
+            bool ok = bool(manifest.read((char*) &count, sizeof(count))) && count <= uint32_t(regions_width * regions_height);
+            for (uint32_t i = 0; ok && i < count; i++) {
+                uint32_t region;
+                ok = manifest.read((char*) &region, sizeof(region)) && region < uint32_t(regions_width * regions_height);
+                if (ok) active.push_back(region);
+            }
+            if (ok && header.version >= 3) {
+                // the run goes on from the tick it was flushed at, with its
+                // seed, temperatures and falling bodies
+                int64_t tick;
+                uint64_t seed;
+                ok = manifest.read((char*) &tick, sizeof(tick)) && manifest.read((char*) &seed, sizeof(seed)) && tick >= 0;
+                std::vector<uint8_t> rest((std::istreambuf_iterator<char>(manifest)), std::istreambuf_iterator<char>());
+                const uint8_t* at = rest.data();
+                const uint8_t* end = at + rest.size();
+                ok = ok && readHeat(engine, at, end) && readMotions(engine, at, end);
+                if (ok) {
+                    engine.tick_count = tick;
+                    engine.seed(seed);
+                }
+            }
+            if (!ok) {
+                std::cerr << manifest_path << " is corrupt" << std::endl;
+                return false;
+            }
+        }
+        // the map on disk takes over from whatever the world was built with,
+        // pending chunks included, which come back with their regions
+        for (int region = 0; region < regions_width * regions_height; region++) {
+            if (!std::filesystem::exists(regionPath(region))) continue;
+            changed[region] = 0;
+            evict(region);
+            const int first_xx = region % regions_width * region_chunks;
+            const int first_yy = region / regions_width * region_chunks;
+            for (int yy = first_yy; yy < std::min(first_yy + region_chunks, engine.chunks_height); yy++) {
+                for (int xx = first_xx; xx < std::min(first_xx + region_chunks, engine.chunks_width); xx++) engine.clearDirty(xx, yy);
+            }
+        }
+    } else if (!writeManifest(active)) {
+        return false;
+    }
+
+    engine.held_chunks = &held;
+    running.store(true, std::memory_order_release);
+    io = std::thread(&RegionStore::ioLoop, this);
+    // the activity of the last run goes on from where it was flushed
+    for (int region : active) load(region);
+    drain(true);
+    return true;
+}
+
+void RegionStore::ioLoop() {
+    Job job;
+    while (true) {
+        if (!requests.pop(job)) {
+            // only stopped once nothing is in flight, so nothing is left behind
+            if (!running.load(std::memory_order_acquire)) return;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        if (job.write) {
+            job.ok = writeRegion(regionPath(job.region), *job.image, job.bytes);
+        } else {
+            job.image = std::make_shared<RegionImage>();
+            job.ok = readRegion(regionPath(job.region), *job.image, job.bytes);
+        }
+        while (!results.push(job)) std::this_thread::yield();
+        job = Job {};
+    }
+}
+
+void RegionStore::submit(const Job& job) {
+    in_flight++;
+    if (!backlog.empty() || !requests.push(job)) backlog.push_back(job);
+}
+
+void RegionStore::drain(bool wait) {
+    while (true) {
+        while (!backlog.empty() && requests.push(backlog.front())) backlog.pop_front();
+        Job job;
+        while (results.pop(job)) finish(job);
+        if (!wait || !in_flight) return;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void RegionStore::finish(Job& job) {
+    in_flight--;
+    const int region = job.region;
+    if (job.write) {
+        if (job.ok) {
+            bytes_written += job.bytes;
+            // unless it was wanted back meanwhile; its read follows the write
+            if (states[region] == WRITING) states[region] = STORED;
+        } else {
+            // the cells are still in the image, so nothing is lost
+            failed = true;
+            if (states[region] != RESIDENT) install(region, *job.image);
+            setResident(region);
+            changed[region] = 1;
+        }
+    } else if (states[region] == LOADING) {
+        if (job.ok) {
+            bytes_read += job.bytes;
+            install(region, *job.image);
+            loads++;
+        } else {
+            // left as the fill it was paged out as, rather than tried forever
+            failed = true;
+        }
+        setResident(region);
+        changed[region] = 0;
+    }
+}
+
+void RegionStore::load(int region) {
+    if (states[region] != STORED && states[region] != WRITING) return;
+    states[region] = LOADING;
+    submit(Job { region, false, false, 0, nullptr });
+}
+
+void RegionStore::install(int region, const RegionImage& image) {
+    World& world = engine.world;
+    const int first_xx = region % regions_width * region_chunks;
+    const int first_yy = region / regions_width * region_chunks;
+    for (int i = 0; i < region_area; i++) {
+        int xx = first_xx + i % region_chunks, yy = first_yy + i / region_chunks;
+        if (xx >= engine.chunks_width || yy >= engine.chunks_height) continue;
+        const ChunkImage& source = image[i];
+        // the rigid bodies skipped it while it was on disk
+        engine.bodies.rescanChunk(xx + yy * engine.chunks_width);
+        if (source.fill != NULL_ELEMENT) {
+            world.fillChunk(xx, yy, source.fill);
+            engine.markDirtyRect(xx, yy, source.rect);
+            continue;
+        }
+        World::Chunk* chunk = world.materialize(xx, yy);
+        std::memcpy(chunk->matrix, source.matrix, sizeof(chunk->matrix));
+        std::memcpy(chunk->speeds, source.speeds, sizeof(chunk->speeds));
+        std::memcpy(chunk->settled, source.settled, sizeof(chunk->settled));
+        // epochs only tell apart cells stepped this tick, and none were
+        std::memset(chunk->epochs, 0, sizeof(chunk->epochs));
+        chunk->settled_rows = 0;
+        for (int y = 0; y < World::chunk_size; y++) chunk->settled_rows |= (chunk->settled[y] != 0) << y;
+        engine.markDirtyRect(xx, yy, source.rect);
+    }
+}
+
+std::shared_ptr<RegionStore::RegionImage> RegionStore::capture(int region) const {
+    const World& world = engine.world;
+    const int first_xx = region % regions_width * region_chunks;
+    const int first_yy = region / regions_width * region_chunks;
+    std::shared_ptr<RegionImage> image = std::make_shared<RegionImage>(region_area);
+    for (int i = 0; i < region_area; i++) {
+        int xx = first_xx + i % region_chunks, yy = first_yy + i / region_chunks;
+        ChunkImage& target = (*image)[i];
+        const bool inside = xx < engine.chunks_width && yy < engine.chunks_height;
+        target.rect = inside ? engine.pendingRect(xx, yy) : EMPTY_RECT;
+        const World::Chunk* chunk = inside ? world.chunkAt(xx, yy) : nullptr;
+        if (!chunk) {
+            target.fill = inside ? world.fillAt(xx, yy) : EMPTY_CELL;
+            continue;
+        }
+        target.fill = NULL_ELEMENT;
+        std::memcpy(target.matrix, chunk->matrix, sizeof(target.matrix));
+        std::memcpy(target.speeds, chunk->speeds, sizeof(target.speeds));
+        std::memcpy(target.settled, chunk->settled, sizeof(target.settled));
+    }
+    return image;
+}
+
+void RegionStore::evict(int region) {
+    // unchanged since it was read, its file still holds it
+    if (changed[region]) {
+        submit(Job { region, true, false, 0, capture(region) });
+        changed[region] = 0;
+        states[region] = WRITING;
+    } else {
+        states[region] = STORED;
+    }
+    const int first_xx = region % regions_width * region_chunks;
+    const int first_yy = region / regions_width * region_chunks;
+    for (int yy = first_yy; yy < std::min(first_yy + region_chunks, engine.chunks_height); yy++) {
+        for (int xx = first_xx; xx < std::min(first_xx + region_chunks, engine.chunks_width); xx++) {
+            engine.world.fillChunk(xx, yy, IMMOVEABLE_SOLID);
+            held[xx + yy * engine.chunks_width] |= ON_DISK;
+        }
+    }
+}
+
+void RegionStore::setResident(int region) {
+    states[region] = RESIDENT;
+    const int first_xx = region % regions_width * region_chunks;
+    const int first_yy = region / regions_width * region_chunks;
+    for (int yy = first_yy; yy < std::min(first_yy + region_chunks, engine.chunks_height); yy++) {
+        for (int xx = first_xx; xx < std::min(first_xx + region_chunks, engine.chunks_width); xx++) {
+            held[xx + yy * engine.chunks_width] &= ~ON_DISK;
+        }
+    }
+}
+
+bool RegionStore::hotNear(int region) const {
+    const int first_xx = std::max(region % regions_width * region_chunks - 1, 0);
+    const int first_yy = std::max(region / regions_width * region_chunks - 1, 0);
+    const int last_xx = std::min((region % regions_width + 1) * region_chunks, engine.chunks_width - 1);
+    const int last_yy = std::min((region / regions_width + 1) * region_chunks, engine.chunks_height - 1);
+    for (int yy = first_yy; yy <= last_yy; yy++) {
+        for (int xx = first_xx; xx <= last_xx; xx++) {
+            if (engine.heat.isHot(xx + yy * engine.chunks_width)) return true;
+        }
+    }
+    return false;
+}
+
+size_t RegionStore::residentBytes() const {
+    return size_t(engine.world.allocatedChunks()) * sizeof(World::Chunk);
+}
+
+int RegionStore::residentRegions() const {
+    return std::count(states.begin(), states.end(), RESIDENT);
+}
+
+void RegionStore::service() {
+    PROFILE_SCOPE("region store");
+    services++;
+    drain(false);
+
+    // The regions around the activity are wanted, and read if they are on
+    // disk, a region ahead of it, so they are usually in by the time it
+    // reaches them.
+    const int chunks_width = engine.chunks_width;
+    engine.pendingChunks(pending);
+    for (int index : pending) changed[regionOf(index)] = 1;
+    // heat spreads a chunk a tick at most and can't be held, so hot chunks
+    // want their regions around them as well
+    wanting = pending;
+    wanting.insert(wanting.end(), engine.heat.hotChunkIndices().begin(), engine.heat.hotChunkIndices().end());
+    for (int index : wanting) {
+        int rx = index % chunks_width / region_chunks, ry = index / chunks_width / region_chunks;
+        for (int y = std::max(ry - 1, 0); y <= std::min(ry + 1, regions_height - 1); y++) {
+            for (int x = std::max(rx - 1, 0); x <= std::min(rx + 1, regions_width - 1); x++) {
+                int region = x + y * regions_width;
+                if (last_used[region] == services) continue;
+                last_used[region] = services;
+                load(region);
+            }
+        }
+    }
+
+    // a chunk can only update with its 8 neighbours in memory
+    for (int index : held_list) held[index] &= ~NEXT_TO_DISK;
+    held_list.clear();
+    long held_count = 0;
+    for (int index : pending) {
+        if (held[index]) {
+            held_count++;
+            continue;
+        }
+        int xx = index % chunks_width, yy = index / chunks_width;
+        bool ready = true;
+        for (int y = std::max(yy - 1, 0); y <= std::min(yy + 1, engine.chunks_height - 1) && ready; y++) {
+            for (int x = std::max(xx - 1, 0); x <= std::min(xx + 1, chunks_width - 1); x++) {
+                if (states[x / region_chunks + y / region_chunks * regions_width] != RESIDENT) {
+                    ready = false;
+                    break;
+                }
+            }
+        }
+        if (ready) continue;
+        held[index] |= NEXT_TO_DISK;
+        held_list.push_back(index);
+        held_count++;
+    }
+    held_chunk_ticks += held_count;
+    PROFILE_COUNTER("held chunks", held_count);
+
+    if (residentBytes() > budget) evictIdle();
+}
+
+void RegionStore::evictIdle() {
+    candidates.clear();
+    for (int region = 0; region < regions_width * regions_height; region++) {
+        if (states[region] == RESIDENT && last_used[region] != services) candidates.push_back(region);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [this] (int a, int b) { return last_used[a] < last_used[b]; });
+    for (int region : candidates) {
+        if (residentBytes() <= budget) return;
+        // one without planes would free nothing
+        const int first_xx = region % regions_width * region_chunks;
+        const int first_yy = region / regions_width * region_chunks;
+        bool allocated = false;
+        for (int yy = first_yy; yy < std::min(first_yy + region_chunks, engine.chunks_height) && !allocated; yy++) {
+            for (int xx = first_xx; xx < std::min(first_xx + region_chunks, engine.chunks_width); xx++) {
+                if (engine.world.chunkAt(xx, yy)) {
+                    allocated = true;
+                    break;
+                }
+            }
+        }
+        if (allocated && !hotNear(region)) {
+            evict(region);
+            evictions++;
+        }
+    }
+}
+
+void RegionStore::waitResident(int first_rx, int first_ry, int last_rx, int last_ry) {
+    for (int ry = first_ry; ry <= last_ry; ry++) {
+        for (int rx = first_rx; rx <= last_rx; rx++) load(rx + ry * regions_width);
+    }
+    while (true) {
+        drain(false);
+        bool resident = true;
+        for (int ry = first_ry; ry <= last_ry && resident; ry++) {
+            for (int rx = first_rx; rx <= last_rx && resident; rx++) resident = states[rx + ry * regions_width] == RESIDENT;
+        }
+        if (resident) return;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void RegionStore::require(int min_x, int min_y, int max_x, int max_y) {
+    min_x = std::max(min_x, 0);
+    min_y = std::max(min_y, 0);
+    max_x = std::min(max_x, engine.world.width - 1);
+    max_y = std::min(max_y, engine.world.height - 1);
+    if (min_x > max_x || min_y > max_y) return;
+    waitResident(min_x / region_size, min_y / region_size, max_x / region_size, max_y / region_size);
+}
+
+void RegionStore::loadAll() {
+    waitResident(0, 0, regions_width - 1, regions_height - 1);
+}
+
+bool RegionStore::flush() {
+    // pending rects are kept with their chunks, so the regions holding any are
+    // read in, and what changed since the last service() isn't noted yet
+    engine.pendingChunks(pending);
+    for (int index : pending) load(regionOf(index));
+    drain(true);
+    std::vector<int> active;
+    for (int index : pending) {
+        changed[regionOf(index)] = 1;
+        active.push_back(regionOf(index));
+    }
+    std::sort(active.begin(), active.end());
+    active.erase(std::unique(active.begin(), active.end()), active.end());
+    const bool failed_before = failed;
+    failed = false;
+    for (int region = 0; region < regions_width * regions_height; region++) {
+        if (states[region] != RESIDENT || !changed[region]) continue;
+        // written from a copy, so the region stays
+        submit(Job { region, true, false, 0, capture(region) });
+        changed[region] = 0;
+        drain(false);
+    }
+    drain(true);
+    if (!writeManifest(active)) failed = true;
+    const bool ok = !failed;
+    failed = failed || failed_before;
+    return ok;
+}
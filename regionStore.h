@@ -0,0 +1,179 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "engine.h"
+#include "spscQueue.h"
+
+// Out-of-core paging of the chunk planes, for big maps where only the area
+// around the activity is live. Chunks are grouped in regions of region_chunks
+// x region_chunks, and each region has a file of its own in the store's
+// directory. Between ticks, service():
+//
+//   - installs the regions a background thread finished reading
+//   - has that thread read the regions around every pending chunk, so they
+//     arrive while the activity is still on its way to them
+//   - holds, through Engine::held_chunks, the chunks on disk and the pending
+//     chunks next to them: those stay pending, without being updated, and
+//     rigid bodies wait for them, until they arrive, so updateWorld() never
+//     waits for the disk
+//   - while the chunk planes take more than the budget, writes out the
+//     regions wanted least recently among the idle ones, those with no
+//     pending chunk near them and nothing hot in or next to them, and drops
+//     their chunks
+//
+// The budget is a soft one: the regions around the activity stay, so the
+// chunk planes go over it for as long as the activity needs more.
+//
+// A region on disk is left in the world as IMMOVEABLE_SOLID fills owning no
+// planes, which nothing moves into and heat doesn't change. Only the planes,
+// sizeof(World::Chunk) or 802 bytes a chunk, are paged and counted against the
+// budget. The rest stays whole in memory: about 160 bytes a chunk for the chunk
+// table, the dirty rects and the heat field, which alone takes 128, and for a
+// chunk holding rigid solids some 320 bytes more plus 16 per component, as the
+// solids keep what an evicted chunk held. A paged world still has to fit that,
+// a fifth of its planes and up to three fifths where solids fill it.
+// Heat spreading into a region on disk changes nothing there until it arrives;
+// the regions around hot chunks are read like those around pending ones.
+//
+// Files are written under a temporary name and renamed into place, next to a
+// manifest of the world size, so the directory is a persistent map: opening it
+// again starts every region it holds on disk, reads in those flush() left
+// pending chunks in, with their dirty rects, and the rest follow as the
+// activity reaches them. The manifest keeps the tick, the seed, the heat field
+// and the motion of the falling bodies, so the run goes on where it stopped.
+// As long as no chunk was held, a run pages out and back in exactly and ends
+// where it would have without paging. A held chunk steps later than it would
+// have, which held_chunk_ticks counts.
+//
+// Region file layout, in host (little endian) byte order:
+//   header   magic "FSRG", version, chunk_size, region_chunks
+//   records  one per chunk of the region in row order, those past the world's
+//            edge included, as in snapshots: the pending rect (4 x u8, since
+//            version 2), encoding (u8), then
+//              FILL  the material of a chunk that owns no planes (u8)
+//              RLE   payload size (u16), then (run length - 1, material) pairs
+//              RAW   chunk_area materials
+//            and for RLE and RAW the settled rows (chunk_size x u16), then the
+//            speeds as payload size (u16) and (run length - 1, speed) pairs
+// The manifest, world.fsrs, holds magic "FSRS", version, width, height,
+// chunk_size and region_chunks, then, since version 2, the count (u32) and
+// indices (u32) of the regions that held pending chunks at the last flush(),
+// then, since version 3, the engine's tick_count (i64) and seed (u64) and the
+// heat and bodies sections of a snapshot, all as of that flush().
+class RegionStore {
+public:
+    const static int region_chunks = 16; // per side
+    const static int region_size = region_chunks * World::chunk_size; // cells per side
+
+    const int regions_width;
+    const int regions_height;
+
+    // the engine must outlive the store
+    RegionStore(Engine& engine, const std::string& directory, size_t budget_bytes);
+    // waits for the reads and writes in flight; doesn't flush()
+    ~RegionStore();
+
+    // creates the directory, or opens the map already in it along with the
+    // engine's tick, seed, heat and falling bodies, and starts the background
+    // thread; false after printing why
+    bool open();
+    // whether the directory holds a map open() would resume
+    static bool holdsMap(const std::string& directory);
+
+    // between ticks, right before updateWorld(), after whatever else changed
+    // the world
+    void service();
+    // Reads the regions overlapping the box, clipped to the world, waiting for
+    // them, so an edit can be applied there between ticks.
+    void require(int min_x, int min_y, int max_x, int max_y);
+    void loadAll(); // every region, waiting
+    // writes every region that changed since it was last written, and the
+    // manifest, waiting, so the directory holds the whole world; false if any
+    // write failed
+    bool flush();
+
+    size_t residentBytes() const; // of chunk planes, against the budget, which it can exceed
+    int residentRegions() const;
+
+    // since open()
+    long loads;            // regions read back in
+    long evictions;        // regions dropped from memory
+    long held_chunk_ticks; // pending chunks held by service(), summed over ticks
+    long bytes_written;
+    long bytes_read;
+    bool failed;           // a region couldn't be read or written, printed as it happened
+
+private:
+    enum RegionState : uint8_t {
+        RESIDENT,
+        WRITING, // dropped, its write in flight
+        STORED,
+        LOADING, // its read in flight
+    };
+
+    struct ChunkImage {
+        DirtyRect rect;   // pending
+        ElementType fill; // NULL_ELEMENT if the chunk owns planes, which follow
+        ElementType matrix[World::chunk_area];
+        uint8_t speeds[World::chunk_area];
+        uint16_t settled[World::chunk_size];
+    };
+    typedef std::vector<ChunkImage> RegionImage; // region_chunks^2, row by row
+
+    // for the background thread, which only ever touches files and images
+    struct Job {
+        int region;
+        bool write;
+        bool ok;
+        size_t bytes;
+        std::shared_ptr<RegionImage> image; // to write, or read into
+    };
+
+    Engine& engine;
+    const std::string directory;
+    const size_t budget;
+
+    std::vector<RegionState> states;
+    std::vector<uint8_t> changed; // per region: differs from its file, if any
+    std::vector<long> last_used;  // per region: the service() that last wanted it
+    long services;
+    // per chunk, what Engine::held_chunks points at
+    enum HeldReason : uint8_t { ON_DISK = 1, NEXT_TO_DISK = 2 };
+    std::vector<uint8_t> held;
+    std::vector<int> held_list;   // the chunks held NEXT_TO_DISK
+    std::vector<int> pending;     // scratch for Engine::pendingChunks()
+    std::vector<int> wanting;     // pending and hot chunks
+    std::vector<int> candidates;  // scratch for evictIdle()
+
+    SpscQueue<Job, 256> requests; // to the background thread
+    SpscQueue<Job, 256> results;  // back from it
+    std::deque<Job> backlog;      // requests the queue had no room for yet
+    long in_flight;
+    std::atomic<bool> running;
+    std::thread io;
+
+    std::string regionPath(int region) const;
+    int regionOf(int chunk) const;
+    bool writeManifest(const std::vector<int>& active) const; // false after printing why
+    // on the background thread; false after printing why
+    static bool writeRegion(const std::string& path, const RegionImage& image, size_t& bytes);
+    static bool readRegion(const std::string& path, RegionImage& image, size_t& bytes);
+    void ioLoop();
+    void submit(const Job& job);
+    // hands over the backlog and handles the results; with wait, until
+    // nothing is in flight
+    void drain(bool wait);
+    void finish(Job& job);
+    void load(int region);
+    void install(int region, const RegionImage& image);
+    std::shared_ptr<RegionImage> capture(int region) const;
+    void evict(int region); // writes it out if it changed, and drops it
+    void setResident(int region);
+    void evictIdle();
+    bool hotNear(int region) const;
+    void waitResident(int first_rx, int first_ry, int last_rx, int last_ry);
+};
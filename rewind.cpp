@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "rewind.h"
+#include "chunkRecords.h"
+#include "profiler.h"
+
+static const int chunk_area = World::chunk_area;
+
+static void append(std::vector<uint8_t>& data, const void* bytes, size_t size) {
+    data.insert(data.end(), (const uint8_t*) bytes, (const uint8_t*) bytes + size);
+}
+
+template <typename T>
+static T readAt(const uint8_t* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// the materials of chunk (xx, yy), whether it owns planes or not
+static void copyChunk(const World& world, int xx, int yy, uint8_t* out) {
+    const World::Chunk* chunk = world.chunkAt(xx, yy);
+    if (chunk) std::memcpy(out, chunk->matrix, chunk_area);
+    else std::memset(out, world.fillAt(xx, yy), chunk_area);
+}
+
+RewindBuffer::RewindBuffer(const Engine& engine, size_t budget_bytes, int keyframe_interval) :
+    chunks_width(engine.chunks_width),
+    chunks_height(engine.chunks_height),
+    budget(budget_bytes),
+    keyframe_interval(std::max(keyframe_interval, 1))
+{
+    key.resize(size_t(chunks_width) * chunks_height * chunk_area);
+    mirror.resize(key.size());
+    total_bytes = 0;
+    last_bytes = 0;
+    last_keyframe = false;
+}
+
+void RewindBuffer::clear() {
+    segments.clear();
+    total_bytes = 0;
+}
+
+long RewindBuffer::oldestTick() const {
+    return segments.empty() ? -1 : segments.front().first_tick;
+}
+
+long RewindBuffer::newestTick() const {
+    if (segments.empty()) return -1;
+    return segments.back().first_tick + segments.back().starts.size() - 1;
+}
+
+void RewindBuffer::record(const Engine& engine) {
+    PROFILE_SCOPE("rewind");
+    if (segments.empty() || engine.tick_count != newestTick() + 1) clear();
+    if (segments.empty() || engine.tick_count - segments.back().first_tick >= keyframe_interval) keyframe(engine);
+    else delta(engine);
+
+    // old segments go first; the newest is needed to record on
+    while (segments.size() > 1 && total_bytes > budget) {
+        total_bytes -= segments.front().data.size();
+        segments.pop_front();
+    }
+    PROFILE_COUNTER("rewind bytes", last_bytes);
+}
+
+void RewindBuffer::keyframe(const Engine& engine) {
+    segments.push_back(Segment { engine.tick_count, {}, { 0 } });
+    Segment& segment = segments.back();
+    uint8_t runs[2 + 2 * chunk_area];
+    for (int index = 0; index < chunks_width * chunks_height; index++) {
+        uint8_t* cells = key.data() + size_t(index) * chunk_area;
+        copyChunk(engine.world, index % chunks_width, index / chunks_width, cells);
+        append(segment.data, runs, writeRuns(cells, runs));
+    }
+    mirror = key;
+    last_bytes = segment.data.size();
+    last_keyframe = true;
+    total_bytes += last_bytes;
+}
+
+void RewindBuffer::delta(const Engine& engine) {
+    // Every cell that changed since the last record lies in a chunk the tick
+    // updated, or in one marked dirty since, which includes the edits applied
+    // before the tick. Those are only candidates: the ones that hold the same
+    // as at the last record are left out.
+    engine.pendingChunks(pending);
+    changed.clear();
+    std::set_union(engine.touchedChunks().begin(), engine.touchedChunks().end(),
+                   pending.begin(), pending.end(), std::back_inserter(changed));
+
+    Segment& segment = segments.back();
+    const size_t start = segment.data.size();
+    segment.starts.push_back(start);
+    uint32_t count = 0;
+    append(segment.data, &count, sizeof(count));
+    uint8_t cells[chunk_area], runs[2 + 2 * chunk_area];
+    for (int index : changed) {
+        uint8_t* previous = mirror.data() + size_t(index) * chunk_area;
+        copyChunk(engine.world, index % chunks_width, index / chunks_width, cells);
+        if (!std::memcmp(cells, previous, chunk_area)) continue;
+        std::memcpy(previous, cells, chunk_area);
+        const uint8_t* base = key.data() + size_t(index) * chunk_area;
+        for (int i = 0; i < chunk_area; i++) cells[i] ^= base[i];
+        uint32_t chunk = index;
+        append(segment.data, &chunk, sizeof(chunk));
+        append(segment.data, runs, writeRuns(cells, runs));
+        count++;
+    }
+    std::memcpy(segment.data.data() + start, &count, sizeof(count));
+    last_bytes = segment.data.size() - start;
+    last_keyframe = false;
+    total_bytes += last_bytes;
+}
+
+void RewindBuffer::rebuild(const Segment& segment, long tick, std::vector<uint8_t>& keyframe_cells, std::vector<uint8_t>& cells) const {
+    keyframe_cells.resize(key.size());
+    const uint8_t* data = segment.data.data();
+    const uint8_t* end = data + segment.data.size();
+    for (int index = 0; index < chunks_width * chunks_height; index++) {
+        readRuns(data, end, 256, keyframe_cells.data() + size_t(index) * chunk_area);
+    }
+    cells = keyframe_cells;
+
+    // each tick's chunks replace what earlier ticks stored for them
+    uint8_t delta[chunk_area];
+    for (long t = segment.first_tick + 1; t <= tick; t++) {
+        data = segment.data.data() + segment.starts[t - segment.first_tick];
+        uint32_t count = readAt<uint32_t>(data);
+        data += 4;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index = readAt<uint32_t>(data);
+            data += 4;
+            readRuns(data, end, 256, delta);
+            uint8_t* out = cells.data() + size_t(index) * chunk_area;
+            const uint8_t* base = keyframe_cells.data() + size_t(index) * chunk_area;
+            for (int j = 0; j < chunk_area; j++) out[j] = base[j] ^ delta[j];
+        }
+    }
+}
+
+bool RewindBuffer::seek(Engine& engine, long tick) {
+    if (segments.empty() || tick < oldestTick() || tick > newestTick()) return false;
+    PROFILE_SCOPE("rewind seek");
+    size_t s = segments.size() - 1;
+    while (segments[s].first_tick > tick) s--;
+    std::vector<uint8_t> keyframe_cells, cells;
+    rebuild(segments[s], tick, keyframe_cells, cells);
+
+    World& world = engine.world;
+    for (int index = 0; index < chunks_width * chunks_height; index++) {
+        const uint8_t* chunk_cells = cells.data() + size_t(index) * chunk_area;
+        int xx = index % chunks_width, yy = index / chunks_width;
+        if (std::all_of(chunk_cells, chunk_cells + chunk_area, [&] (uint8_t e) { return e == chunk_cells[0]; })) {
+            world.fillChunk(xx, yy, ElementType(chunk_cells[0]));
+        } else {
+            std::memcpy(world.materialize(xx, yy)->matrix, chunk_cells, chunk_area);
+        }
+    }
+    // the state around the cells starts over, as for a world built from scratch
+    world.clearEpochs();
+    world.clearSpeeds();
+    world.unsettle(0, 0, world.width - 1, world.height - 1);
+    engine.bodies.reset();
+    engine.heat.reset();
+    engine.tick_count = tick;
+    engine.markAllDirty();
+
+    // recording goes on from here
+    Segment& segment = segments[s];
+    size_t kept = tick - segment.first_tick + 1;
+    size_t end = kept < segment.starts.size() ? segment.starts[kept] : segment.data.size();
+    segment.data.resize(end);
+    segment.starts.resize(kept);
+    segments.erase(segments.begin() + s + 1, segments.end());
+    total_bytes = 0;
+    for (const Segment& kept_segment : segments) total_bytes += kept_segment.data.size();
+    key = std::move(keyframe_cells);
+    mirror = std::move(cells);
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "engine.h"
+
+// Recent history of the world, to step back to any of the last few thousand
+// ticks when chasing a glitch. After every tick record() stores only the
+// chunks that changed during it, found through the engine's dirty chunks and
+// confirmed against a copy of the world as of the previous tick. Each is stored
+// XORed with the chunk in the last keyframe, so cells that still hold what they
+// held then are zero, and run-length encoded as (run length - 1, byte) pairs,
+// like snapshots. A keyframe, every chunk run-length encoded, starts a new
+// segment every keyframe_interval ticks.
+//
+// Whole segments are dropped, oldest first, to stay within the budget, and the
+// newest one is always kept. Besides the budget, the buffer holds two copies
+// of the world's materials, the last keyframe and the previous tick.
+//
+// Only materials are recorded. seek() brings back the cells exactly, but
+// restarts the settled bits, the particle speeds, the heat field and the rigid
+// bodies as a world built from scratch would, so running on from there only continues like the
+// original run up to those.
+class RewindBuffer {
+public:
+    RewindBuffer(const Engine& engine, size_t budget_bytes, int keyframe_interval = 256);
+
+    // after every updateWorld(). A tick that doesn't follow the last one
+    // recorded, after a reset or a snapshot load, starts the history over.
+    void record(const Engine& engine);
+    void clear();
+
+    // Sets the world back to how it was after tick, which must lie within
+    // [oldestTick(), newestTick()], and drops the history after it. Returns
+    // false, changing nothing, if it doesn't.
+    bool seek(Engine& engine, long tick);
+
+    bool empty() const { return segments.empty(); }
+    long oldestTick() const;
+    long newestTick() const;
+    size_t bytes() const { return total_bytes; } // of history, against the budget
+
+    // what the last record() stored, in bytes, and whether it was a keyframe
+    size_t last_bytes;
+    bool last_keyframe;
+
+private:
+    struct Segment {
+        long first_tick;            // of the keyframe
+        std::vector<uint8_t> data;  // the keyframe, then one record per tick
+        std::vector<size_t> starts; // offset in data of each tick, the keyframe's first
+    };
+
+    const int chunks_width;
+    const int chunks_height;
+    const size_t budget;
+    const int keyframe_interval;
+
+    std::deque<Segment> segments;
+    size_t total_bytes;
+    std::vector<uint8_t> key;    // the cells of the newest keyframe, chunk after chunk
+    std::vector<uint8_t> mirror; // the cells as of the last record
+    std::vector<int> pending;    // scratch for Engine::pendingChunks()
+    std::vector<int> changed;
+
+    void keyframe(const Engine& engine);
+    void delta(const Engine& engine);
+    // the chunks' bytes as they were after tick, which lies in segment
+    void rebuild(const Segment& segment, long tick, std::vector<uint8_t>& keyframe_cells, std::vector<uint8_t>& cells) const;
+};
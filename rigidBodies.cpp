@@ -0,0 +1,584 @@
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "rigidBodies.h"
+#include "engine.h"
+#include "profiler.h"
+
+// what bodies fall through, pushing it up past them
+static const uint32_t PASSABLE = 1u << EMPTY_CELL | 1u << WATER | 1u << GAS | 1u << ACID | 1u << FIRE;
+// in 1/256 cells per tick
+static const int GRAVITY = 32;
+static const int TOP_SPEED = MAX_SPEED << 8; // as fast as falling particles
+
+RigidBodies::RigidBodies(int world_width, int world_height) :
+    width(world_width),
+    height(world_height),
+    chunks_width(world_width / World::chunk_size),
+    chunks_height(world_height / World::chunk_size)
+{
+    slots.assign(chunks_width * chunks_height, -1);
+    touched.assign(chunks_width * chunks_height, 0);
+    loose.assign(chunks_width * chunks_height, 0);
+    node_count = 0;
+    full_scan = true;
+}
+
+void RigidBodies::reset() {
+    std::fill(slots.begin(), slots.end(), -1);
+    solids.clear();
+    free_slots.clear();
+    std::fill(loose.begin(), loose.end(), 0);
+    loose_chunks.clear();
+    node_count = 0;
+    bodies.clear();
+    carried.clear();
+    stale.clear();
+    full_scan = true;
+}
+
+int RigidBodies::fallingCount() const {
+    int count = 0;
+    for (const Body& body : bodies) count += !body.resting;
+    return count;
+}
+
+static ElementType cellAt(const World& world, int x, int y) {
+    const World::Chunk* chunk = world.chunkAt(x >> World::chunk_shift, y >> World::chunk_shift);
+    return chunk ? chunk->matrix[World::localIndex(x, y)] : world.fillAt(x >> World::chunk_shift, y >> World::chunk_shift);
+}
+
+// the caller unsettles and marks dirty, once per body
+static void writeCell(World& world, int x, int y, ElementType e) {
+    World::Chunk* chunk = world.chunkAt(x >> World::chunk_shift, y >> World::chunk_shift);
+    if (!chunk) {
+        if (world.fillAt(x >> World::chunk_shift, y >> World::chunk_shift) == e) return;
+        chunk = world.materialize(x >> World::chunk_shift, y >> World::chunk_shift);
+    }
+    chunk->matrix[World::localIndex(x, y)] = e;
+    chunk->speeds[World::localIndex(x, y)] = 0;
+}
+
+// 4-connected components of the solid cells, numbered from 1 in scan order
+static int labelComponents(const uint16_t rows[World::chunk_size], uint8_t labels[World::chunk_area]) {
+    const int n = World::chunk_size;
+    std::memset(labels, 0, World::chunk_area);
+    uint8_t stack[World::chunk_area]; // every cell is pushed at most once
+    int count = 0;
+    for (int i = 0; i < World::chunk_area; i++) {
+        if (!(rows[i / n] >> (i % n) & 1) || labels[i]) continue;
+        count++;
+        int top = 0;
+        labels[i] = count;
+        stack[top++] = i;
+        while (top) {
+            int j = stack[--top];
+            int x = j % n, y = j / n;
+            auto visit = [&] (int vx, int vy) {
+                if (vx < 0 || vx >= n || vy < 0 || vy >= n) return;
+                int k = vx + vy * n;
+                if (!(rows[vy] >> vx & 1) || labels[k]) return;
+                labels[k] = count;
+                stack[top++] = k;
+            };
+            visit(x - 1, y);
+            visit(x + 1, y);
+            visit(x, y - 1);
+            visit(x, y + 1);
+        }
+    }
+    return count;
+}
+
+bool RigidBodies::rescan(const World& world, int xx, int yy) {
+    uint16_t rows[World::chunk_size];
+    const World::Chunk* chunk = world.chunkAt(xx, yy);
+    if (!chunk) {
+        std::fill(rows, rows + World::chunk_size, world.fillAt(xx, yy) == IMMOVEABLE_SOLID ? 0xFFFF : 0);
+    } else {
+#if defined(__SSE2__)
+        const __m128i solid = _mm_set1_epi8(IMMOVEABLE_SOLID);
+        for (int y = 0; y < World::chunk_size; y++) {
+            __m128i materials = _mm_loadu_si128((const __m128i*) (chunk->matrix + y * World::chunk_size));
+            rows[y] = _mm_movemask_epi8(_mm_cmpeq_epi8(materials, solid));
+        }
+#else
+        for (int y = 0; y < World::chunk_size; y++) {
+            rows[y] = 0;
+            for (int x = 0; x < World::chunk_size; x++) rows[y] |= (chunk->matrix[x + y * World::chunk_size] == IMMOVEABLE_SOLID) << x;
+        }
+#endif
+    }
+    bool any = false;
+    for (int y = 0; y < World::chunk_size; y++) any |= rows[y] != 0;
+
+    const int index = xx + yy * chunks_width;
+    int& slot = slots[index];
+    if (slot < 0) {
+        if (!any) return false;
+        if (free_slots.empty()) {
+            slot = solids.size();
+            solids.emplace_back();
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        solids[slot].chunk = index;
+        std::memset(solids[slot].labels, 0, sizeof(solids[slot].labels));
+    } else if (!std::memcmp(rows, solids[slot].rows, sizeof(rows))) {
+        return false;
+    } else if (!any) {
+        for (int i = 0; i < int(solids[slot].nodes.size()); i++) loosen(slot * node_stride + i);
+        node_count -= solids[slot].nodes.size();
+        solids[slot].nodes.clear();
+        free_slots.push_back(slot);
+        slot = -1;
+        return true;
+    }
+    relabel(slot, rows);
+    markLoose(index);
+    return true;
+}
+
+void RigidBodies::relabel(int slot, const uint16_t rows[World::chunk_size]) {
+    ChunkSolids& target = solids[slot];
+    const int base = slot * node_stride;
+    uint8_t fresh[World::chunk_area];
+    const int count = labelComponents(rows, fresh);
+
+    // A node that kept all its cells stays, in the component of the new
+    // labelling holding them, and so does its place in the union-find. One
+    // that lost any is taken apart with its whole component, since that may
+    // have split.
+    int old_cells[node_stride] = {};
+    int into[node_stride]; // the new component holding a node's cells
+    bool lost[node_stride] = {};
+    int new_cells[World::chunk_area / 2 + 1] = {};
+    const int old_count = target.nodes.size();
+    for (int i = 0; i < World::chunk_area; i++) {
+        new_cells[fresh[i]]++;
+        if (!target.labels[i]) continue;
+        const int j = target.labels[i] - 1;
+        old_cells[j]++;
+        if (fresh[i]) into[j] = fresh[i];
+        else lost[j] = true;
+    }
+    for (int j = 0; j < old_count; j++) {
+        if (lost[j]) loosen(base + j);
+    }
+
+    int node_of[World::chunk_area / 2 + 1]; // per new component
+    std::fill(node_of, node_of + count + 1, -1);
+    bool same[World::chunk_area / 2 + 1]; // holds exactly the cells of its node
+    for (int j = 0; j < old_count; j++) {
+        if (lost[j] || !old_cells[j]) continue;
+        const int c = into[j];
+        if (node_of[c] < 0) {
+            node_of[c] = j;
+            same[c] = old_cells[j] == new_cells[c];
+        } else {
+            // joined in this chunk; the other node stays behind, without cells
+            unite(base + node_of[c], base + j);
+            same[c] = false;
+        }
+    }
+    // the rest take free nodes: without cells and alone in their component
+    bool taken[node_stride] = {};
+    for (int c = 1; c <= count; c++) {
+        if (node_of[c] >= 0) taken[node_of[c]] = true;
+    }
+    int next_free = 0;
+    for (int c = 1; c <= count; c++) {
+        if (node_of[c] >= 0) continue;
+        while (next_free < int(target.nodes.size()) && (taken[next_free] || target.nodes[next_free].parent != base + next_free ||
+                                                        target.nodes[next_free].next != base + next_free)) next_free++;
+        if (next_free == node_stride) {
+            // too many left behind: the chunk starts over
+            for (int j = 0; j < int(target.nodes.size()); j++) loosen(base + j);
+            node_count -= target.nodes.size();
+            target.nodes.clear();
+            for (int k = 1; k <= count; k++) node_of[k] = k - 1;
+            std::fill(same + 1, same + count + 1, false);
+            break;
+        }
+        node_of[c] = next_free;
+        same[c] = false;
+        taken[next_free] = true;
+        if (next_free == int(target.nodes.size())) {
+            target.nodes.emplace_back();
+            node_count++;
+        }
+        target.nodes[next_free] = Node { base + next_free, base + next_free, -1, 0 };
+    }
+    if (int(target.nodes.size()) < count) {
+        node_count += count - target.nodes.size();
+        target.nodes.resize(count);
+        for (int j = 0; j < count; j++) target.nodes[j] = Node { base + j, base + j, -1, 0 };
+    }
+
+    // a body whose cells changed is gathered again
+    for (int c = 1; c <= count; c++) {
+        if (same[c]) continue;
+        Node& top = node(find(base + node_of[c]));
+        if (top.island >= 0) bodies[top.island].root = -1;
+        top.island = -1;
+    }
+    std::memcpy(target.rows, rows, sizeof(target.rows));
+    for (int i = 0; i < World::chunk_area; i++) target.labels[i] = fresh[i] ? node_of[fresh[i]] + 1 : 0;
+}
+
+void RigidBodies::markLoose(int chunk) {
+    if (loose[chunk]) return;
+    loose[chunk] = 1;
+    loose_chunks.push_back(chunk);
+}
+
+void RigidBodies::loosen(int id) {
+    const int root = find(id);
+    if (node(root).island >= 0) bodies[node(root).island].root = -1;
+    // every node of the component starts over on its own
+    id = root;
+    do {
+        Node& member = node(id);
+        const int next = member.next;
+        member = Node { id, id, -1, 0 };
+        markLoose(solids[id / node_stride].chunk);
+        id = next;
+    } while (id != root);
+}
+
+int RigidBodies::find(int id) {
+    while (node(id).parent != id) {
+        node(id).parent = node(node(id).parent).parent;
+        id = node(id).parent;
+    }
+    return id;
+}
+
+// the lower root wins, so the result doesn't depend on the order of unions
+void RigidBodies::unite(int a, int b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) return;
+    if (b < a) std::swap(a, b);
+    Node& winner = node(a);
+    Node& loser = node(b);
+    loser.parent = a;
+    winner.anchored |= loser.anchored;
+    std::swap(winner.next, loser.next);
+    // a body whose component grew is gathered again
+    if (winner.island >= 0) bodies[winner.island].root = -1;
+    if (loser.island >= 0) bodies[loser.island].root = -1;
+    winner.island = -1;
+    loser.island = -1;
+}
+
+int RigidBodies::nodeAt(int x, int y) const {
+    if (x < 0 || x >= width || y < 0 || y >= height) return -1;
+    int slot = slots[(x >> World::chunk_shift) + (y >> World::chunk_shift) * chunks_width];
+    if (slot < 0) return -1;
+    int label = solids[slot].labels[World::localIndex(x, y)];
+    return label ? slot * node_stride + label - 1 : -1;
+}
+
+void RigidBodies::stitchRight(int left, int right) {
+    if (left < 0 || right < 0) return;
+    const int n = World::chunk_size;
+    const ChunkSolids& a = solids[left];
+    const ChunkSolids& b = solids[right];
+    // a pair of nodes is joined once, not once per cell along the border
+    int last_a = 0, last_b = 0;
+    for (int y = 0; y < n; y++) {
+        if (!(a.rows[y] >> (n - 1) & b.rows[y] & 1)) continue;
+        const int label_a = a.labels[y * n + n - 1], label_b = b.labels[y * n];
+        if (label_a == last_a && label_b == last_b) continue;
+        unite(left * node_stride + label_a - 1, right * node_stride + label_b - 1);
+        last_a = label_a;
+        last_b = label_b;
+    }
+}
+
+void RigidBodies::stitchBelow(int above, int below) {
+    if (above < 0 || below < 0) return;
+    const int n = World::chunk_size;
+    const ChunkSolids& a = solids[above];
+    const ChunkSolids& b = solids[below];
+    uint16_t both = a.rows[n - 1] & b.rows[0];
+    int last_a = 0, last_b = 0;
+    for (int x = 0; x < n; x++) {
+        if (!(both >> x & 1)) continue;
+        const int label_a = a.labels[(n - 1) * n + x], label_b = b.labels[x];
+        if (label_a == last_a && label_b == last_b) continue;
+        unite(above * node_stride + label_a - 1, below * node_stride + label_b - 1);
+        last_a = label_a;
+        last_b = label_b;
+    }
+}
+
+bool RigidBodies::gather(Body& body) {
+    const int n = World::chunk_size;
+    // the nodes of the component in chunk order, (chunk, label)
+    members.clear();
+    int id = body.root;
+    do {
+        members.emplace_back(solids[id / node_stride].chunk, id % node_stride + 1);
+        id = node(id).next;
+    } while (id != body.root);
+    std::sort(members.begin(), members.end());
+
+    bool in_body[node_stride + 1]; // per label of a chunk
+    for (size_t first = 0; first < members.size();) {
+        const int index = members[first].first;
+        const ChunkSolids& chunk = solids[slots[index]];
+        std::fill(in_body, in_body + chunk.nodes.size() + 1, false);
+        size_t last = first;
+        for (; last < members.size() && members[last].first == index; last++) in_body[members[last].second] = true;
+        first = last;
+        const bool first_cells = body.runs.empty();
+        int first_cell = World::chunk_area;
+        const int xx = index % chunks_width, yy = index / chunks_width;
+        for (int x = 0; x < n; x++) {
+            int start = -1;
+            for (int y = 0; y <= n; y++) {
+                bool in = y < n && in_body[chunk.labels[y * n + x]];
+                if (in && start < 0) start = y;
+                if (in || start < 0) continue;
+                body.runs.push_back(Run { xx * n + x, yy * n + start, yy * n + y - 1 });
+                first_cell = std::min(first_cell, start * n + x);
+                start = -1;
+            }
+        }
+        // bodies go in the order a scan of the world meets them
+        if (first_cells) body.order = (long) index * World::chunk_area + first_cell;
+    }
+    if (body.runs.empty()) return false;
+    // join the runs a chunk border split
+    std::sort(body.runs.begin(), body.runs.end(), [] (const Run& a, const Run& b) {
+        return a.x != b.x ? a.x < b.x : a.top < b.top;
+    });
+    size_t joined = 0;
+    for (size_t i = 1; i < body.runs.size(); i++) {
+        Run& last = body.runs[joined];
+        if (last.x == body.runs[i].x && last.bottom + 1 == body.runs[i].top) last.bottom = body.runs[i].bottom;
+        else body.runs[++joined] = body.runs[i];
+    }
+    body.runs.resize(joined + 1);
+    return true;
+}
+
+void RigidBodies::rebuild() {
+    PROFILE_SCOPE("rebuild components");
+    const int n = World::chunk_size;
+    std::sort(loose_chunks.begin(), loose_chunks.end());
+
+    // stitch the loose chunks to their neighbours, a border shared by two of
+    // them once, then anchor what touches the sides or the bottom of the world
+    for (int index : loose_chunks) {
+        const int slot = slots[index];
+        if (slot < 0) continue;
+        const int xx = index % chunks_width, yy = index / chunks_width;
+        if (xx > 0 && !loose[index - 1]) stitchRight(slots[index - 1], slot);
+        if (xx + 1 < chunks_width) stitchRight(slot, slots[index + 1]);
+        if (yy > 0 && !loose[index - chunks_width]) stitchBelow(slots[index - chunks_width], slot);
+        if (yy + 1 < chunks_height) stitchBelow(slot, slots[index + chunks_width]);
+    }
+    for (int index : loose_chunks) {
+        const int slot = slots[index];
+        if (slot < 0) continue;
+        const int xx = index % chunks_width, yy = index / chunks_width;
+        const ChunkSolids& a = solids[slot];
+        auto anchor = [&] (int i) { node(find(slot * node_stride + a.labels[i] - 1)).anchored = 1; };
+        for (int y = 0; y < n; y++) {
+            if (xx == 0 && a.rows[y] & 1) anchor(y * n);
+            if (xx == chunks_width - 1 && a.rows[y] >> (n - 1) & 1) anchor(y * n + n - 1);
+        }
+        if (yy == chunks_height - 1) {
+            for (int x = 0; x < n; x++) {
+                if (a.rows[n - 1] >> x & 1) anchor((n - 1) * n + x);
+            }
+        }
+    }
+
+    // bodies taken apart hand their motion on to what they are part of now
+    for (const Body& body : bodies) {
+        if (body.root < 0 && !body.resting) carried.push_back(Motion { body.runs[0].x, body.runs[0].top, body.speed, body.travel });
+    }
+    bodies.erase(std::remove_if(bodies.begin(), bodies.end(), [] (const Body& body) { return body.root < 0; }), bodies.end());
+    for (size_t i = 0; i < bodies.size(); i++) node(bodies[i].root).island = i;
+
+    // the unanchored components among the loose ones become bodies
+    for (int index : loose_chunks) {
+        const int slot = slots[index];
+        if (slot < 0) continue;
+        for (int i = 0; i < int(solids[slot].nodes.size()); i++) {
+            const int root = find(slot * node_stride + i);
+            Node& top = node(root);
+            if (top.anchored || top.island >= 0) continue;
+            bodies.push_back(Body { {}, 0, 0, false, {}, root, 0 });
+            // nodes left without cells make none
+            if (gather(bodies.back())) top.island = bodies.size() - 1;
+            else bodies.pop_back();
+        }
+    }
+    std::sort(bodies.begin(), bodies.end(), [] (const Body& a, const Body& b) { return a.order < b.order; });
+    for (size_t i = 0; i < bodies.size(); i++) node(bodies[i].root).island = i;
+
+    // bodies that were falling keep falling
+    for (const Motion& motion : carried) {
+        int id = nodeAt(motion.x, motion.y);
+        if (id < 0 || node(find(id)).island < 0) continue;
+        Body& body = bodies[node(find(id)).island];
+        if (motion.speed > body.speed) {
+            body.speed = motion.speed;
+            body.travel = motion.travel;
+        }
+    }
+    carried.clear();
+    for (int index : loose_chunks) loose[index] = 0;
+    loose_chunks.clear();
+    PROFILE_COUNTER("solid components", node_count);
+    PROFILE_COUNTER("rigid bodies", bodies.size());
+}
+
+bool RigidBodies::canFall(World& world, const Body& body) const {
+    for (const Run& run : body.runs) {
+        if (run.bottom + 1 >= height || !(PASSABLE >> cellAt(world, run.x, run.bottom + 1) & 1)) return false;
+    }
+    return true;
+}
+
+void RigidBodies::rest(Body& body) {
+    body.resting = true;
+    body.speed = 0;
+    body.travel = 0;
+    body.watch.clear();
+    for (const Run& run : body.runs) {
+        if (run.bottom + 1 < height) body.watch.push_back((run.x >> World::chunk_shift) + ((run.bottom + 1) >> World::chunk_shift) * chunks_width);
+    }
+    std::sort(body.watch.begin(), body.watch.end());
+    body.watch.erase(std::unique(body.watch.begin(), body.watch.end()), body.watch.end());
+}
+
+bool RigidBodies::waitForHeld(Engine& engine, const Body& body) const {
+    // what a tick's fall can reach: the body and the cells it can fall into
+    const std::vector<uint8_t>& held = *engine.held_chunks;
+    bool waiting = false;
+    for (const Run& run : body.runs) {
+        int last = std::min(run.bottom + (TOP_SPEED >> 8), height - 1);
+        for (int y = run.top; y <= last; y = (y | (World::chunk_size - 1)) + 1) {
+            if (!held[(run.x >> World::chunk_shift) + (y >> World::chunk_shift) * chunks_width]) continue;
+            // asks for the chunk, as a cell changing in it would
+            engine.markDirty(run.x, y);
+            waiting = true;
+        }
+    }
+    return waiting;
+}
+
+void RigidBodies::fall(Engine& engine, Body& body) {
+    World& world = engine.world;
+    if (!canFall(world, body)) {
+        rest(body);
+        return;
+    }
+    body.speed = std::min(body.speed + GRAVITY, TOP_SPEED);
+    body.travel += body.speed;
+    int steps = body.travel >> 8;
+    body.travel &= 0xFF;
+
+    // one cell at a time: each run moves down and the cell under it moves up
+    // to the run's top
+    DirtyBox moved;
+    for (int step = 0; step < steps; step++) {
+        if (step > 0 && !canFall(world, body)) {
+            rest(body);
+            break;
+        }
+        for (Run& run : body.runs) {
+            writeCell(world, run.x, run.top, cellAt(world, run.x, run.bottom + 1));
+            writeCell(world, run.x, run.bottom + 1, IMMOVEABLE_SOLID);
+            moved.include(run.x, run.top);
+            moved.include(run.x, run.bottom + 1);
+            run.top++;
+            run.bottom++;
+        }
+    }
+    if (moved.empty()) return;
+    world.unsettle(moved.min_x - 1, moved.min_y - 1, moved.max_x + 1, moved.max_y + 1);
+    engine.markDirtyBox(moved);
+    // its nodes no longer hold its cells, so it is gathered again where it is
+    if (body.root >= 0) loosen(body.root);
+}
+
+void RigidBodies::step(Engine& engine) {
+    PROFILE_SCOPE("rigid bodies");
+    World& world = engine.world;
+    bool changed = false;
+    // held chunks are looked at once they are released, which touches them or,
+    // for those read back in, has them rescanned
+    const std::vector<uint8_t>* held = engine.held_chunks;
+    if (full_scan) {
+        for (int chunk = 0; chunk < chunks_width * chunks_height; chunk++) {
+            if (held && (*held)[chunk]) continue;
+            if (rescan(world, chunk % chunks_width, chunk / chunks_width)) changed = true;
+        }
+        full_scan = false;
+    }
+    size_t kept = 0;
+    for (int chunk : stale) {
+        if (held && (*held)[chunk]) {
+            stale[kept++] = chunk;
+            continue;
+        }
+        if (rescan(world, chunk % chunks_width, chunk / chunks_width)) changed = true;
+    }
+    stale.resize(kept);
+    for (int chunk : engine.touchedChunks()) {
+        if (held && (*held)[chunk]) continue;
+        touched[chunk] = 1;
+        if (rescan(world, chunk % chunks_width, chunk / chunks_width)) changed = true;
+    }
+
+    if (changed) {
+        rebuild();
+        // every body looks at what is under it again, as if gathered afresh
+        for (Body& body : bodies) body.resting = false;
+    } else {
+        // resting bodies wake once what is under them changed
+        for (Body& body : bodies) {
+            if (!body.resting) continue;
+            for (int chunk : body.watch) {
+                if (touched[chunk]) {
+                    body.resting = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int chunk : engine.touchedChunks()) touched[chunk] = 0;
+
+    for (Body& body : bodies) {
+        if (!body.resting && !(held && waitForHeld(engine, body))) fall(engine, body);
+    }
+    PROFILE_COUNTER("falling bodies", fallingCount());
+}
+
+void RigidBodies::rescanChunk(int chunk) {
+    stale.push_back(chunk);
+}
+
+void RigidBodies::read(std::vector<Motion>& out) const {
+    out.clear();
+    for (const Body& body : bodies) {
+        if (!body.resting) out.push_back(Motion { body.runs[0].x, body.runs[0].top, body.speed, body.travel });
+    }
+}
+
+void RigidBodies::write(const std::vector<Motion>& in) {
+    // every body is gathered afresh, to take its motion
+    reset();
+    carried = in;
+}
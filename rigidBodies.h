@@ -0,0 +1,129 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "world.h"
+
+class Engine;
+
+// Solid cells that lost their support fall as one piece. A solid cell is
+// supported when a path of solid cells, 4-connected, leads from it to the
+// bottom, left or right edge of the world; islands of solid that reach none
+// become bodies.
+//
+// Connectivity is kept incrementally, in two levels:
+//
+//   - per chunk, its solid cells as a bitmask and their 4-connected components
+//     within the chunk. A chunk is only relabelled when its mask changed, and
+//     only chunks the tick touched are looked at.
+//   - across chunks, a union-find over those chunk local components, stitched
+//     along the chunk borders, that lasts from tick to tick. When a chunk's
+//     mask changes, only the components that lost cells there, which may have
+//     split, are taken apart and stitched again with whatever they touch now;
+//     new solids join what they touch. A tick costs what those components
+//     span rather than what the world does, and a falling body, which moves
+//     all its cells, costs its own size.
+//
+// A body is its cells as vertical runs, one per column segment. It falls under
+// gravity through empty cells, gases and light liquids, which move up past it
+// so nothing is lost, and comes to rest, staying an island, on anything else.
+// A resting body is only looked at again once a chunk under it is touched.
+// Held chunks (Engine::held_chunks) aren't rescanned until released, not even
+// by a full scan, and a falling body that would reach into one waits for it.
+class RigidBodies {
+public:
+    RigidBodies(int world_width, int world_height);
+
+    void reset();
+    int bodyCount() const { return bodies.size(); }
+    int fallingCount() const;
+
+    // called by Engine::updateWorld, after the chunks of the tick updated
+    void step(Engine& engine);
+    // the cells of the chunk changed between ticks without it being marked
+    // dirty, as when its region is read back in; rescanned on the next step
+    void rescanChunk(int chunk);
+
+    // for snapshots: the motion of the falling bodies, each told by one of its
+    // cells. Everything else is recomputed from the world.
+    struct Motion {
+        int32_t x, y;   // a cell of the body
+        int32_t speed;  // in 1/256 cells per tick
+        int32_t travel; // fraction of a cell moved so far, in 1/256 cells
+    };
+    void read(std::vector<Motion>& out) const;
+    void write(const std::vector<Motion>& in); // after the world is loaded
+
+private:
+    struct Run {
+        int x, top, bottom; // inclusive
+    };
+    struct Body {
+        std::vector<Run> runs; // by column, then top to bottom
+        int speed, travel;
+        bool resting;
+        std::vector<int> watch; // chunks holding the cells right under it
+        int root;   // of its component, -1 once it was taken apart or changed
+        long order; // its first cell in a scan of the world, chunk by chunk
+    };
+
+    // A chunk local component, in the union-find. Node ids are slot *
+    // node_stride + its index in the chunk's nodes, and the lowest id of a
+    // component is its root. A node keeps its id for as long as it keeps its
+    // cells, so the union-find lasts; nodes merged within their chunk stay
+    // behind without cells until their component is taken apart.
+    struct Node {
+        int parent;
+        int next;         // the ring of the nodes of its component
+        int island;       // a root's index into bodies, or -1
+        uint8_t anchored; // a root's: the component reaches the sides or the bottom
+    };
+    const static int node_stride = World::chunk_area / 2; // the most components a chunk holds
+
+    // the solids of a chunk holding any, and their components
+    struct ChunkSolids {
+        uint16_t rows[World::chunk_size]; // bit x of rows[y]: cell (x, y) is solid
+        uint8_t labels[World::chunk_area]; // its node, from 1; 0 for not solid
+        int chunk; // its index
+        std::vector<Node> nodes; // labels index it
+    };
+
+    const int width;
+    const int height;
+    const int chunks_width;
+    const int chunks_height;
+
+    std::vector<int> slots; // per chunk, its index in solids or -1
+    std::vector<ChunkSolids> solids;
+    std::vector<int> free_slots;
+    bool full_scan; // every chunk is rescanned on the next step
+    std::vector<int> stale; // chunks to rescan on the next step, from rescanChunk()
+    std::vector<uint8_t> touched; // per chunk, during a step
+    std::vector<uint8_t> loose;   // per chunk: holds components to stitch again
+    std::vector<int> loose_chunks;
+    int node_count;
+
+    std::vector<Body> bodies; // in order
+    std::vector<Motion> carried; // motion to hand to the next rebuild's bodies
+
+    // false if the mask didn't change; otherwise the chunk is relabelled, to
+    // be stitched again by rebuild()
+    bool rescan(const World& world, int xx, int yy);
+    void relabel(int slot, const uint16_t rows[World::chunk_size]);
+    void loosen(int id); // takes apart the node's component
+    void markLoose(int chunk);
+    void rebuild();
+    void stitchRight(int left, int right); // slots, or -1
+    void stitchBelow(int above, int below);
+    bool gather(Body& body); // its runs and order, from its component; false if it has no cells
+    std::vector<std::pair<int, int>> members; // scratch for gather()
+    Node& node(int id) { return solids[id / node_stride].nodes[id % node_stride]; }
+    int find(int id);
+    void unite(int a, int b);
+    int nodeAt(int x, int y) const; // -1 unless (x, y) is solid
+    bool canFall(World& world, const Body& body) const;
+    void fall(Engine& engine, Body& body);
+    // true if the body would reach into a held chunk, which it marks dirty
+    bool waitForHeld(Engine& engine, const Body& body) const;
+    void rest(Body& body);
+};
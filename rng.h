@@ -1,21 +1,33 @@
 #pragma once
+#include <cstdint>
 
-static unsigned long x=123456789, y=362436069, z=521288629;
+// Stateless, counter based random numbers. Every value is a pure function of
+// (seed, tick, stream, index), so threads can draw them in any order without
+// sharing state, and a seed reproduces the same world whatever the thread
+// count.
 
-inline unsigned long xorshf96(void) {          //period 2^96-1
-unsigned long t;
-    x ^= x << 16;
-    x ^= x >> 5;
-    x ^= x << 1;
+// splitmix64 finalizer
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
 
-   t = x;
-   x = y;
-   y = z;
-   z = t ^ x ^ y;
+// independent sequences drawn from the same seed and tick
+enum RandomStream : uint64_t {
+    CELL_STREAM,     // choices made by World::update, indexed by cell
+    ROW_STREAM,      // scan direction of chunk rows, indexed by row and chunk
+    SCENARIO_STREAM, // initial worlds, indexed by cell
+    EDIT_STREAM,     // edits the headless driver makes, indexed by edit
+    REACTION_STREAM, // reaction rolls, indexed by cell
+    HEAT_STREAM,     // heat transition rolls, indexed by cell
+};
 
-  return z;
+// computed once per tick and stream, so the inner loop pays a single mix
+inline uint64_t tickKey(uint64_t seed, uint64_t tick, RandomStream stream) {
+    return mix64(mix64(seed ^ stream * 0xd1b54a32d192ed03ULL) + tick);
 }
 
-inline bool fiftyFifty() {
-    return z & 1; 
+inline uint64_t randomAt(uint64_t tick_key, uint64_t index) {
+    return mix64(tick_key + index * 0x9e3779b97f4a7c15ULL);
 }
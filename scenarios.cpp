@@ -0,0 +1,156 @@
+#include <algorithm>
+#include "scenarios.h"
+#include "rng.h"
+
+// fills the rectangle [x1, x2) x [y1, y2), clipped to the world
+static void fillRect(World& world, int x1, int y1, int x2, int y2, ElementType e) {
+    for (int y = y1; y < y2; y++) world.fillSpan(x1, x2 - 1, y, e);
+}
+
+// fills the disc of cells at most r from (x, y), clipped to the world
+static void fillDisc(World& world, int x, int y, int r, ElementType e) {
+    for (int dy = -r; dy <= r; dy++) {
+        int half = 0;
+        while ((half + 1) * (half + 1) + dy * dy <= r * r) half++;
+        world.fillSpan(x - half, x + half, y + dy, e);
+    }
+}
+
+static void setupEmpty(World& world, uint64_t seed) {}
+
+// the top half of the world is solid sand which collapses onto the floor
+static void setupSand(World& world, uint64_t seed) {
+    fillRect(world, 0, 0, world.width, world.height / 2, SAND);
+}
+
+// an open tank, half full of water, with a block of water above it pouring in
+static void setupTank(World& world, uint64_t seed) {
+    int left = world.width / 8;
+    int right = world.width - world.width / 8;
+    int top = world.height / 3;
+    int bottom = world.height - 1;
+    fillRect(world, left - 4, bottom - 4, right + 4, bottom + 1, IMMOVEABLE_SOLID);
+    fillRect(world, left - 4, top, left, bottom, IMMOVEABLE_SOLID);
+    fillRect(world, right, top, right + 4, bottom, IMMOVEABLE_SOLID);
+    fillRect(world, left, (top + bottom) / 2, right, bottom - 4, WATER);
+    fillRect(world, world.width / 2 - 16, 0, world.width / 2 + 16, top / 2, WATER);
+}
+
+// sparse grains of sand and water scattered over the whole world
+static void setupRain(World& world, uint64_t seed) {
+    uint64_t key = tickKey(seed, 0, SCENARIO_STREAM);
+    for (int y = 0; y < world.height; y++) {
+        for (int x = 0; x < world.width; x++) {
+            uint64_t r = randomAt(key, x + y * world.width) % 100;
+            if (r == 0) world.setElementAtPosition(x, y, SAND);
+            else if (r == 1) world.setElementAtPosition(x, y, WATER);
+        }
+    }
+}
+
+// a reservoir on a high ledge that spills over its open end onto the floor
+static void setupWaterfall(World& world, uint64_t seed) {
+    int ledge_y = world.height / 3;
+    int ledge_end = world.width / 2;
+    fillRect(world, 0, ledge_y, ledge_end, ledge_y + 4, IMMOVEABLE_SOLID);
+    fillRect(world, 0, ledge_y / 4, ledge_end - 8, ledge_y, WATER);
+    fillRect(world, 0, world.height - 4, world.width, world.height, IMMOVEABLE_SOLID);
+}
+
+// mostly sky over mostly bedrock: a band of sand dunes with a lake in a dip,
+// fed by a block of water falling from the sky
+static void setupTerrain(World& world, uint64_t seed) {
+    uint64_t key = tickKey(seed, 0, SCENARIO_STREAM);
+    int bedrock = world.height * 2 / 3;
+    fillRect(world, 0, bedrock, world.width, world.height, IMMOVEABLE_SOLID);
+    int dune = 0;
+    for (int x = 0; x < world.width; x++) {
+        dune = std::clamp<int>(dune + randomAt(key, x) % 3 - 1, 0, 32);
+        fillRect(world, x, bedrock - 8 - dune, x + 1, bedrock, SAND);
+    }
+    int lake = world.width / 3;
+    fillRect(world, lake, bedrock - 40, lake + world.width / 8, bedrock - 8, WATER);
+    fillRect(world, lake, world.height / 16, lake + 32, world.height / 16 + 32, WATER);
+}
+
+// a forest of wooden trees and undergrowth on a sand floor, with ponds under
+// the undergrowth and pockets of gas between the trees, set alight by a lava
+// pool at its left edge
+static void setupForest(World& world, uint64_t seed) {
+    uint64_t key = tickKey(seed, 0, SCENARIO_STREAM);
+    int ground = world.height - 24;
+    fillRect(world, 0, world.height - 8, world.width, world.height, IMMOVEABLE_SOLID);
+    fillRect(world, 0, ground, world.width, world.height - 8, SAND);
+    fillRect(world, 0, ground - 3, world.width, ground, WOOD);
+    int x = 48;
+    for (int tree = 0; x < world.width - 16; tree++) {
+        uint64_t r = randomAt(key, tree);
+        int height = world.height / 4 + r % (world.height / 3);
+        int crown = 10 + (r >> 16) % 12;
+        fillRect(world, x - 2, ground - height, x + 2, ground, WOOD);
+        fillDisc(world, x, ground - height, crown, WOOD);
+        fillDisc(world, x - crown / 2, ground - height + crown / 2, crown * 2 / 3, WOOD);
+        fillDisc(world, x + crown / 2, ground - height + crown / 2, crown * 2 / 3, WOOD);
+        // every few trees a pond or a pocket of gas on the ground after it
+        int gap = 20 + (r >> 24) % 24;
+        if ((r >> 32) % 4 == 0) fillRect(world, x + 8, ground, x + gap - 8, ground + 6, WATER);
+        else if ((r >> 32) % 4 == 1) fillDisc(world, x + gap / 2, ground - 12, 6, GAS);
+        x += gap;
+    }
+    fillRect(world, 0, ground - 12, 32, ground, LAVA);
+}
+
+// stone slabs on wooden posts, one of them bridging a walled pool, with lava
+// between the posts; as the posts burn away the slabs fall as whole pieces
+static void setupCollapse(World& world, uint64_t seed) {
+    int floor = world.height - 8;
+    fillRect(world, 0, floor, world.width, world.height, IMMOVEABLE_SOLID);
+    auto slab = [&] (int left, int right, int top) {
+        fillRect(world, left, top - 12, right, top, IMMOVEABLE_SOLID);
+        fillRect(world, left + 4, top, left + 10, floor, WOOD);
+        fillRect(world, right - 10, top, right - 4, floor, WOOD);
+    };
+    int pool = world.width / 2, pool_end = pool + world.width / 4;
+    fillRect(world, pool - 4, floor - 48, pool, floor, IMMOVEABLE_SOLID);
+    fillRect(world, pool_end, floor - 48, pool_end + 4, floor, IMMOVEABLE_SOLID);
+    fillRect(world, pool, floor - 40, pool_end, floor, WATER);
+    slab(pool - 24, pool_end + 24, floor - 100);
+    fillRect(world, pool - 40, floor - 6, pool - 4, floor, LAVA);
+    fillRect(world, pool_end + 4, floor - 6, pool_end + 40, floor, LAVA);
+    for (int i = 1; i < 8; i++) {
+        int x = world.width * i / 8;
+        if (x > pool - 64 && x < pool_end + 64) continue;
+        slab(x - 40, x + 40, floor - 80 - i % 3 * 40);
+        fillRect(world, x - 20, floor - 6, x + 20, floor, LAVA);
+    }
+}
+
+// the whole world in 8 row bands, water over gas over water, so water sinks
+// through gas everywhere and every chunk stays busy for hundreds of ticks: the
+// worst case for the dirty rects
+static void setupChurn(World& world, uint64_t seed) {
+    for (int y = 0; y < world.height; y += 16) {
+        fillRect(world, 0, y, world.width, y + 8, WATER);
+        fillRect(world, 0, y + 8, world.width, y + 16, GAS);
+    }
+}
+
+const Scenario SCENARIOS[] = {
+    { "empty",     "nothing at all",                                 setupEmpty },
+    { "sand",      "top half of the world filled with sand",         setupSand },
+    { "tank",      "water pouring into a half full tank",            setupTank },
+    { "rain",      "sparse sand and water grains everywhere",        setupRain },
+    { "waterfall", "reservoir on a ledge spilling onto the floor",   setupWaterfall },
+    { "terrain",   "sky over dunes, a lake and bedrock",             setupTerrain },
+    { "forest",    "a forest with ponds and gas set alight by lava", setupForest },
+    { "collapse",  "stone slabs on wooden posts burning away",       setupCollapse },
+    { "churn",     "bands of water and gas filling every chunk",     setupChurn },
+};
+const int scenario_count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+
+const Scenario* findScenario(const std::string& name) {
+    for (int i = 0; i < scenario_count; i++) {
+        if (name == SCENARIOS[i].name) return &SCENARIOS[i];
+    }
+    return nullptr;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include "world.h"
+
+// Initial world layouts used by the headless driver. A scenario only depends on
+// the world dimensions and the seed it is given, so a (scenario, size, seed)
+// triple always produces the same starting world.
+struct Scenario {
+    const char* name;
+    const char* description;
+    void (*setup)(World& world, uint64_t seed);
+};
+
+extern const Scenario SCENARIOS[];
+extern const int scenario_count;
+
+// returns nullptr if no scenario has the given name
+const Scenario* findScenario(const std::string& name);
@@ -1,272 +1,348 @@
 #include <SFML/Graphics/Color.hpp>
 #include <SFML/Graphics/RectangleShape.hpp>
 #include <SFML/System/Vector2.hpp>
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
-#include <chrono>
 #include "simulation.h"
-#include "rng.h"
+#include "snapshot.h"
+#include "edit.h"
+#include "profiler.h"
+#include "constants.h"
 
-Simulation::Simulation(int window_width, int window_height) :
+static const char* const SNAPSHOT_PATH = "world.fsnp";
+#ifdef SAND_PROFILE
+static const char* const TRACE_PATH = "trace.json";
+static const char* const TRACE_CSV_PATH = "trace.csv";
+#endif
+static const int JOURNAL_HASH_INTERVAL = 256; // steps between hashes checked on replay
+static const size_t REWIND_BUDGET = size_t(64) << 20; // bytes of history kept
+static const long REWIND_TICKS = 256; // ticks stepped back per press
+static const float FRAME_BUDGET = 1.f / 60; // seconds, at the display's refresh rate
+static const int MAX_RENDER_INTERVAL = 8; // frames
+static const std::chrono::milliseconds COMMAND_POLL(4); // longest wait for a tick before looking at commands again
+
+Simulation::Simulation(int window_width, int window_height, int world_width, int world_height) :
+    engine(world_width, world_height),
+    world(engine.world),
+    frames(engine),
     window(sf::VideoMode(window_width, window_height), "FallingSand", sf::Style::Resize),
-    world()
+    history(engine, REWIND_BUDGET),
+    timestep(TICK_RATE)
 {
     scale = 1;
     window.setSize(sf::Vector2u(window_width, window_height));
     window.setPosition( {0, 0} );
     // window.setFramerateLimit(1chunk_size0);
+    // ticks don't wait for the display, so there is no point drawing faster
+    window.setVerticalSyncEnabled(true);
     window.setMouseCursorVisible(false);
 
-    view.reset(sf::FloatRect(0, 0, WIDTH, HEIGHT));
+    view.reset(sf::FloatRect(0, 0, world.width, world.height));
     window.setView(view);
 
     frame_count = 0;
-    world_texture.create(WIDTH, HEIGHT);
-    brush_radius = 4;
+    simulating = false;
+    replay_finished = false;
+    step_count = 0;
+    frame = nullptr;
+    render_interval = 1;
+    tick_rate = TICK_RATE;
+    world_texture.create(world.width, world.height);
+    brush = Brush { IMMOVEABLE_SOLID, 4 };
+    stroke_brush = brush;
     mouse_position = sf::Vector2i(0, 0);
-    drawing_element = IMMOVEABLE_SOLID;
-    
-    // set all chunks to active
-    std::memset(chunks, 1, sizeof(chunks));
-
-    // set pixels to 0 to remove artifacting
-    std::memset(pixels, 0, sizeof(pixels));
+    replaying = nullptr;
 
 };
 
-inline void Simulation::updateChunk(int xx, int yy) {
-    if (!chunks[xx][yy]) return;
-    chunks[xx][yy] = false;
-    bool is_active = false;
-    for (int y = (yy + 1) * chunk_size - 1; y >= yy * chunk_size; y--) {
-        if (fiftyFifty()) {
-            for (int x = xx * chunk_size; x < (xx + 1) * chunk_size; x++) {
-                if (world.matrix[x + y * world.width] == EMPTY_CELL) continue;
-                if (world.matrix[x + y * world.width] & (1 << 31)) continue; // if stepped
-                world.matrix[x + y * world.width] = static_cast<ElementType>(world.matrix[x + y * world.width] | (1 << 31)); // set stepped
-                is_active = is_active | world.update(x, y);
-            }
-        } else {
-            for (int x = (xx + 1) * chunk_size - 1; x >= xx * chunk_size; x--) {
-                if (world.matrix[x + y * world.width] == EMPTY_CELL) continue;
-                if (world.matrix[x + y * world.width] & (1 << 31)) continue; // if stepped
-                world.matrix[x + y * world.width] = static_cast<ElementType>(world.matrix[x + y * world.width] | (1 << 31)); // set stepped
-                is_active = is_active | world.update(x, y);
-            }
-        }
-    }
+void Simulation::draw() {
+    PROFILE_SCOPE("draw");
+    // the stroke runs from where the mouse was on the last frame to where it is
+    sf::Vector2i old_pos = static_cast<sf::Vector2i>(window.mapPixelToCoords(mouse_position));
+    sf::Vector2i new_pos = static_cast<sf::Vector2i>(window.mapPixelToCoords(sf::Mouse::getPosition(window)));
+    send(Command { Command::STROKE, { old_pos.x, old_pos.y, new_pos.x, new_pos.y } });
+}
 
-    if (!is_active) return; 
-    for (int y = yy - 1; y <= yy + 1; y++) {
-        for (int x = xx - 1; x <= xx + 1; x++) {
-            if (y < chunks_height && y >= 0 && x < chunks_width && x >= 0) chunks[x][y] = true;                         
-        }
-    }
+void Simulation::record(const std::string& path) {
+    journal.open(path, world.width, world.height, engine.rngSeed());
+    journal.element(stroke_brush.element);
+    journal.radius(stroke_brush.radius);
 }
 
-void Simulation::updateWorld() {
-    // multithreading in 2 stages
-    bool is_active;
-    for (int yy = chunks_height - 1; yy >= 0; yy--) {
-        for (int xx = 0; xx < chunks_width; xx++) {
-            updateChunk(xx, yy);
-        }
-    }
+void Simulation::replay(JournalReplay* journal_replay) {
+    replaying = journal_replay;
+    engine.seed(replaying->seed);
+    // at full speed
+    tick_rate = 0;
+    timestep.setRate(0);
+}
 
-    // CANNOT use chunks, not active does not guarantee no step
-    // unstep all elements
-    for (int i = 0; i < world.size; i++) world.matrix[i] = static_cast<ElementType>(world.matrix[i] & ~(1 << 31));
+void Simulation::setTickRate(int ticks_per_second) {
+    tick_rate = ticks_per_second;
+    send(Command { Command::RATE, { ticks_per_second } });
 }
 
-void Simulation::draw() {
-    // step 0: find old and new mouse positions
-    sf::Vector2i old_pos = static_cast<sf::Vector2i>(window.mapPixelToCoords(mouse_position));
-    sf::Vector2i new_pos = static_cast<sf::Vector2i>(window.mapPixelToCoords(sf::Mouse::getPosition(window)));
-    // step 1: find line between old pos and new pos
-    std::vector<sf::Vector2i> line;
-    line.push_back(old_pos);
-
-    if (old_pos != new_pos) {
-        // swap old and new pos so that old pos is left of new pos
-        if (new_pos.x < old_pos.x) std::swap(new_pos, old_pos);
-
-        float slope = 1. * (old_pos.y - new_pos.y) / (old_pos.x - new_pos.x);
-        float y = old_pos.y;
-        for (int x_offset = 1; x_offset <= new_pos.x - old_pos.x; x_offset++) {
-            y += slope;
-            line.push_back(sf::Vector2i(old_pos.x + x_offset, std::round(y)));
-        }
-    }
+void Simulation::setElement(ElementType e) {
+    brush.element = e;
+    send(Command { Command::ELEMENT, { e } });
+}
+
+void Simulation::send(Command command) {
+    // input is never dropped, a full queue only means the simulation thread is
+    // a long tick behind
+    while (!commands.push(command)) std::this_thread::yield();
+}
+
+void Simulation::execute(const Command& command) {
+    const int* values = command.values;
+    switch (command.type) {
+        case Command::STROKE:
+            journal.stroke(values[0], values[1], values[2], values[3]);
+            paintStroke(engine, stroke_brush, values[0], values[1], values[2], values[3]);
+            break;
+
+        case Command::ELEMENT:
+            stroke_brush.element = ElementType(values[0]);
+            journal.element(stroke_brush.element);
+            break;
+
+        case Command::RADIUS:
+            stroke_brush.radius = values[0];
+            journal.radius(stroke_brush.radius);
+            break;
+
+        case Command::RESET:
+            journal.reset();
+            engine.reset(); // marks everything dirty, so the next frame carries it all
+            break;
 
-    // step 2: iterate across the line
-    for (sf::Vector2i& pos : line) {
-        // in case brush_radius is 0, just draw at self 
-        world.spawnElementAtPosition(pos.x, pos.y, drawing_element);
-        if (world.inBounds(pos.x, pos.y)) chunks[pos.x / chunk_size][pos.y / chunk_size] = true;
-        // step 3: iterate across square of size 2r centered around line px 
-        for (int x = pos.x - brush_radius; x < pos.x + brush_radius; x++) {
-            for (int y = pos.y - brush_radius; y < pos.y + brush_radius; y++) {
-                // step 4: spawn element at cells within circle (use dist formula)
-                if (pow(x - pos.x, 2) + pow(y - pos.y, 2) > pow(brush_radius, 2)) continue;
-                world.spawnElementAtPosition(x, y, drawing_element);
-                if (world.inBounds(x, y)) chunks[x / chunk_size][y / chunk_size] = true;
+        case Command::SAVE:
+            saveSnapshot(engine, SNAPSHOT_PATH);
+            break;
+
+        case Command::LOAD:
+            if (!loadSnapshot(engine, SNAPSHOT_PATH)) break;
+            frames.invalidate();
+            if (journal.isOpen()) {
+                std::cerr << "stopped recording, journals can't replay a loaded snapshot" << std::endl;
+                journal.close();
+            }
+            break;
+
+        case Command::REWIND:
+            if (history.empty()) break;
+            history.seek(engine, std::max(engine.tick_count - REWIND_TICKS, history.oldestTick()));
+            frames.invalidate();
+            if (journal.isOpen()) {
+                std::cerr << "stopped recording, journals can't replay a rewind" << std::endl;
+                journal.close();
             }
-        } 
+            break;
+
+        case Command::RATE:
+            timestep.setRate(values[0]);
+            break;
+
+        case Command::TRACE:
+#ifdef SAND_PROFILE
+            Profiler::writeChromeTrace(TRACE_PATH);
+            Profiler::writeCsv(TRACE_CSV_PATH);
+#endif
+            break;
     }
 }
 
-void Simulation::renderWorld() {
-    // auto t1 = std::chrono::high_resolution_clock::now();
-
-    #if 0
-    auto updatePixels = [this] (int start, int end) {
-        for (int i = start; i < end; i++) {
-            const sf::Color curr_col = PROPERTIES[world.matrix[i]].default_color;
-            pixels[4 * i + 0] = curr_col.r;
-            pixels[4 * i + 1] = curr_col.g;
-            pixels[4 * i + 2] = curr_col.b;
-            pixels[4 * i + 3] = curr_col.a;
+void Simulation::simulate() {
+    Command command;
+    while (simulating.load(std::memory_order_acquire)) {
+        while (commands.pop(command)) execute(command);
+        int substeps = timestep.due();
+        if (!substeps) {
+            timestep.wait(COMMAND_POLL);
+            continue;
         }
-    };
-    // create threads and assign them sections depending on thread count
-    for (int t = 0; t < thread_count; t++) {
-        int start = t * world.size / thread_count;
-        int end = (t + 1) * world.size / thread_count;
-        thread_pool[t] = std::thread(updatePixels, start, end);
-    }
+        PROFILE_COUNTER("substeps", substeps);
 
-    // join threads
-    for (std::thread& thread : thread_pool) {
-        if (thread.joinable()) thread.join();
-    }
-    #else
-    for (int yy = 0; yy < chunks_height; yy++) {
-    for (int xx = 0; xx < chunks_width; xx++) {
-        if (!chunks[xx][yy]) continue;
-        for (int y = yy * chunk_size; y < (yy + 1) * chunk_size; y++) {
-        for (int x = xx * chunk_size; x < (xx + 1) * chunk_size; x++) {
-            std::memcpy(
-                        pixels + (4 * (x + y * world.width)),
-                        &PROPERTIES[world.matrix[(x + y * world.width)]].default_color, 
-                        4
-                    );
-            // int i = x + y * world.width;
-            // const sf::Color& curr_col = PROPERTIES[world.matrix[i]].default_color;
-            // pixels[4 * i + 0] = curr_col.r;
-            // pixels[4 * i + 1] = curr_col.g;
-            // pixels[4 * i + 2] = curr_col.b;
-            // pixels[4 * i + 3] = curr_col.a;
-        }
+        for (int i = 0; i < substeps; i++) {
+            if (replaying && !replaying->apply(engine, stroke_brush)) {
+                replay_finished.store(true, std::memory_order_release);
+                return;
+            }
+
+            // the frame published after the batch carries what every tick of
+            // it changed
+            frames.collect(engine);
+            engine.updateWorld();
+            history.record(engine);
+            journal.step();
+            long steps = step_count.load(std::memory_order_relaxed) + 1;
+            step_count.store(steps, std::memory_order_relaxed);
+            if (journal.isOpen() && steps % JOURNAL_HASH_INTERVAL == 0) journal.hash(world.hash());
         }
+
+        // the window thread renders whatever frame is newest whenever it
+        // gets to it, skipping any it was too slow for
+        frames.publish(engine);
     }
+}
+
+void Simulation::renderWorld(bool refresh) {
+    PROFILE_SCOPE("renderWorld");
+    // only the regions that changed since the last frame are converted and
+    // uploaded, the texture keeps the rest
+    const WorldFrame* latest = refresh ? frames.take() : nullptr;
+    if (latest) {
+        frame = latest;
+        canvas.refresh(*frame);
+        PROFILE_SCOPE("upload");
+        for (const Canvas::Region& region : canvas.regions) {
+            world_texture.update(canvas.pixels.data() + region.offset, region.width, region.height, region.x, region.y);
+        }
     }
-    // for (int i = 0; i < world.size; i++) {
-    //     std::memcpy(pixels + (4 * i), &PROPERTIES[world.matrix[i]].default_color, 4);
-    //     const sf::Color& curr_col = PROPERTIES[world.matrix[i]].default_color;
-    //     pixels[4 * i + 0] = curr_col.r;
-    //     pixels[4 * i + 1] = curr_col.g;
-    //     pixels[4 * i + 2] = curr_col.b;
-    //     pixels[4 * i + 3] = curr_col.a;
-    // }
-    #endif
-    // auto t2 = std::chrono::high_resolution_clock::now();
-    // auto us_int = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
-    // std::cout << us_int.count() << "ns\n";
-
-    world_texture.update(pixels);
     world_sprite.setTexture(world_texture);
     window.draw(world_sprite);
 }
 
+void Simulation::adaptRenderInterval(float refresh_seconds) {
+    // backs off quickly when a refresh eats into the frame, and comes back one
+    // step at a time once refreshes are cheap again
+    if (refresh_seconds > FRAME_BUDGET / 2) {
+        render_interval = std::min(render_interval * 2, MAX_RENDER_INTERVAL);
+    } else if (refresh_seconds < FRAME_BUDGET / 8 && render_interval > 1) {
+        render_interval /= 2;
+    }
+}
+
 void Simulation::renderBrush() {
-    brush_circle.setRadius(brush_radius + .2); // magic .2 for 0 radius
+    brush_circle.setRadius(brush.radius + .2); // magic .2 for 0 radius
     brush_circle.setOutlineThickness(.5 / scale);
     brush_circle.setOutlineColor(sf::Color::White);
     brush_circle.setFillColor(sf::Color::Transparent);
-    brush_circle.setOrigin(brush_radius, brush_radius);
+    brush_circle.setOrigin(brush.radius, brush.radius);
     brush_circle.setPosition(window.mapPixelToCoords(mouse_position));
 
     window.draw(brush_circle);
 }
 
 void Simulation::renderChunks() {
-    sf::RectangleShape square(sf::Vector2f(chunk_size, chunk_size));
+    if (!frame) return;
+    const int chunk_size = Engine::chunk_size;
+    sf::RectangleShape square;
     square.setFillColor(sf::Color::Transparent);
     square.setOutlineColor(sf::Color::Red);
     square.setOutlineThickness(1.);
-    for (int x = 0; x < chunks_width; x++) {
-        for (int y = 0; y < chunks_height; y++) {
-            if (chunks[x][y]) {
-                square.setPosition(chunk_size * x, chunk_size * y);
-                window.draw(square);
-            }
-        }
+    for (int index : frame->pending) {
+        const int x = index % engine.chunks_width;
+        const int y = index / engine.chunks_width;
+        DirtyRect rect = frame->rects[index];
+        if (rect.empty()) continue;
+        square.setSize(sf::Vector2f(rect.max_x - rect.min_x + 1, rect.max_y - rect.min_y + 1));
+        square.setPosition(chunk_size * x + rect.min_x, chunk_size * y + rect.min_y);
+        window.draw(square);
     }
 }
 
 void Simulation::run() {
+    simulating.store(true, std::memory_order_release);
+    simulation_thread = std::thread(&Simulation::simulate, this);
+
     sf::Clock clock;
     float lastTime = false;
+    long last_steps = 0;
     bool mouse_down = false;
     while (window.isOpen()) {
+        PROFILE_SCOPE("frame");
         sf::Event event;
-        while (window.pollEvent(event)) {
-            switch (event.type) {
-                case sf::Event::KeyPressed:
-                    if (sf::Keyboard::isKeyPressed(sf::Keyboard::R)) {
-                        world.reset(); 
-                        std::memset(pixels, 0, sizeof(pixels));
-                    } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num1)) {
-                        drawing_element = IMMOVEABLE_SOLID;
-                    } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num2)) {
-                        drawing_element = SAND;
-                    } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num3)) {
-                        drawing_element = WATER;
-                    }
-                    break;
-
-                case sf::Event::Resized:
-                    scale = std::min(window.getSize().x / world.width, window.getSize().y / world.height);
-                    scale = std::max(scale, 1);
-                    view.setSize(sf::Vector2f(event.size.width/scale, event.size.height/scale));
-                    break;
+        {
+            PROFILE_SCOPE("events");
+            while (window.pollEvent(event)) {
+                // a replay takes no input but closing and resizing the window
+                if (replaying && event.type != sf::Event::Closed && event.type != sf::Event::Resized) continue;
+                switch (event.type) {
+                    case sf::Event::KeyPressed:
+                        if (sf::Keyboard::isKeyPressed(sf::Keyboard::R)) {
+                            send(Command { Command::RESET });
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num1)) {
+                            setElement(IMMOVEABLE_SOLID);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num2)) {
+                            setElement(SAND);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num3)) {
+                            setElement(WATER);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num4)) {
+                            setElement(GAS);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num5)) {
+                            setElement(ACID);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num6)) {
+                            setElement(WOOD);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num7)) {
+                            setElement(FIRE);
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num8)) {
+                            setElement(LAVA);
+#ifdef SAND_PROFILE
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F2)) {
+                            send(Command { Command::TRACE });
+#endif
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F5)) {
+                            send(Command { Command::SAVE });
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F9)) {
+                            send(Command { Command::LOAD });
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Backspace)) {
+                            send(Command { Command::REWIND });
+                        } else if (sf::Keyboard::isKeyPressed(sf::Keyboard::T)) {
+                            // between the set rate and as fast as it goes
+                            setTickRate(tick_rate ? 0 : TICK_RATE);
+                        }
+                        break;
+
+                    case sf::Event::Resized:
+                        scale = std::min(window.getSize().x / world.width, window.getSize().y / world.height);
+                        scale = std::max(scale, 1);
+                        view.setSize(sf::Vector2f(event.size.width/scale, event.size.height/scale));
+                        break;
                 
-                case sf::Event::Closed:
-                    window.close();
-                    break;
-
-                case sf::Event::MouseButtonPressed:
-                    mouse_down = true;
-                    // std::cout << "Pressed! \n";
-                    break;
-
-                case sf::Event::MouseButtonReleased:
-                    mouse_down = false;
-                    // std::cout << "Released! \n";
-                    break;
+                    case sf::Event::Closed:
+                        window.close();
+                        break;
+
+                    case sf::Event::MouseButtonPressed:
+                        mouse_down = true;
+                        // std::cout << "Pressed! \n";
+                        break;
+
+                    case sf::Event::MouseButtonReleased:
+                        mouse_down = false;
+                        // std::cout << "Released! \n";
+                        break;
                 
-                case sf::Event::MouseWheelMoved:
-                    if (event.mouseWheel.delta > 0) {
-                        brush_radius = std::min(brush_radius + 1, 75);
-                    } else {
-                        brush_radius = std::max(brush_radius - 1, 0);
-                    }
-                    break;
+                    case sf::Event::MouseWheelMoved:
+                        if (event.mouseWheel.delta > 0) {
+                            brush.radius = std::min(brush.radius + 1, 75);
+                        } else {
+                            brush.radius = std::max(brush.radius - 1, 0);
+                        }
+                        send(Command { Command::RADIUS, { brush.radius } });
+                        break;
+                }
             }
         }
         window.clear();
 
-
-        updateWorld();
+        if (replay_finished.load(std::memory_order_acquire)) {
+            simulation_thread.join();
+            finishReplay(clock.getElapsedTime().asSeconds());
+            return;
+        }
         frame_count++;
 
-        // draw must be after world update to account for the drawing of cells
-        // which may be marked inactive by the world update and thus, not be rendered
-        if (mouse_down) draw();
+        if (mouse_down && !replaying) draw();
         mouse_position = sf::Mouse::getPosition(window);
 
-        renderWorld();
+        bool refresh = frame_count % render_interval == 0;
+        sf::Clock refresh_clock;
+        renderWorld(refresh);
+        if (refresh) adaptRenderInterval(refresh_clock.getElapsedTime().asSeconds());
         renderBrush();
         renderChunks();
         
@@ -277,10 +353,28 @@ void Simulation::run() {
         if (frame_count % 100 == 0) {
             float currentTime = clock.getElapsedTime().asSeconds();
             double fps = 100.f /(currentTime-lastTime);
+            long steps = step_count.load(std::memory_order_relaxed);
+            double tps = (steps - last_steps) / (currentTime-lastTime);
             lastTime = currentTime;
-            std::cerr << "fps: " << fps << std::endl;
+            last_steps = steps;
+            std::cerr << "fps: " << fps << ", ticks/sec: " << tps;
+            if (tick_rate) std::cerr << " (of " << tick_rate << ")";
+            std::cerr << ", world refreshed every " << render_interval << " frames" << std::endl;
         }
         #endif
-        xorshf96();
     }
+    simulating.store(false, std::memory_order_release);
+    simulation_thread.join();
+}
+
+void Simulation::finishReplay(float seconds) {
+    std::cout << "replayed " << replaying->step_count << " steps in " << seconds << " s ("
+              << replaying->step_count / seconds << " steps/sec), world hash " << std::hex << world.hash() << std::dec
+              << ", " << replaying->hash_checks - replaying->hash_mismatches << " of " << replaying->hash_checks
+              << " hash checks passed" << std::endl;
+#ifdef SAND_PROFILE
+    Profiler::writeChromeTrace(TRACE_PATH);
+    Profiler::writeCsv(TRACE_CSV_PATH);
+#endif
+    window.close();
 }
@@ -1,22 +1,57 @@
 #pragma once
 #include <SFML/Graphics.hpp>
+#include <atomic>
 #include <thread>
+#include <vector>
 #include "elementUtils.h"
-#include "world.h"
-#include "constants.h"
+#include "engine.h"
+#include "canvas.h"
+#include "frameExchange.h"
+#include "spscQueue.h"
+#include "edit.h"
+#include "journal.h"
+#include "rewind.h"
+#include "timestep.h"
 
-// The simulation class is responsible for simulating the world, providing an
-// interface for user interaction, and updating and providing the texture of
-// the cellular matrix.
+// The simulation class is the interactive front end of the engine. It provides
+// an interface for user interaction, and updates and provides the texture of
+// the cellular matrix. Stepping the world is left entirely to the engine.
+//
+// The engine runs on a simulation thread of its own, so ticking never waits
+// for texture uploads or the display, nor the window for a tick. The window
+// thread only ever sees the world through the frames the simulation thread
+// publishes, and only touches it by queueing commands for it, which run
+// between ticks.
+//
+// Ticks run at a fixed rate, several in a row when the simulation thread fell
+// behind, and a frame is published after each batch. When converting and
+// uploading the world texture takes more than its share of a frame, the
+// window thread refreshes it only every few frames instead.
 class Simulation {
-    World world;
+    Engine engine;
+    World& world;
     int frame_count;
-    
+
+    // window thread to simulation thread
+    struct Command {
+        enum Type { STROKE, ELEMENT, RADIUS, RESET, SAVE, LOAD, REWIND, RATE, TRACE } type;
+        int values[4];
+    };
+    SpscQueue<Command, 1024> commands;
+
+    std::thread simulation_thread;
+    std::atomic<bool> simulating;
+    std::atomic<bool> replay_finished;
+    std::atomic<long> step_count; // ticks run by the simulation thread
+
     // graphics stuff
-    sf::Uint8 pixels[4 * WIDTH * HEIGHT];
+    FrameExchange frames;
+    const WorldFrame* frame; // the last frame taken, nullptr before the first
+    Canvas canvas;
     sf::Texture world_texture;
     sf::Sprite world_sprite;
     sf::CircleShape brush_circle;
+    int render_interval; // frames between world texture refreshes
 
     // video and window stuff
     int scale; // scale world sprite UP 
@@ -24,30 +59,41 @@ class Simulation {
     sf::View view;
 
     // GUI and player interaction
-    int brush_radius;
+    Brush brush; // as the player sees it; strokes use stroke_brush
     sf::Vector2i mouse_position; // mouse pos on last frame 
-    ElementType drawing_element;
+    int tick_rate; // as the player set it, 0 for unlimited
 
-    // threading + optimization
-    const static int chunk_size = 16;
-    bool chunks[WIDTH / chunk_size][HEIGHT / chunk_size];
-    int chunks_width = WIDTH / chunk_size;
-    int chunks_height = HEIGHT / chunk_size;
+    // simulation thread only
+    Brush stroke_brush;
+    JournalWriter journal; // records the session while open
+    RewindBuffer history; // the last ticks, to step back through
+    FixedTimestep timestep;
+    JournalReplay* replaying; // input comes from here instead of the player while set
+
+    void send(Command command); // window thread
+    void execute(const Command& command); // simulation thread
+    void simulate(); // the simulation thread
+    void setElement(ElementType e);
+    void adaptRenderInterval(float refresh_seconds);
+    void finishReplay(float seconds);
 
-    int thread_count = std::thread::hardware_concurrency();
-    std::vector<std::thread> thread_pool = std::vector<std::thread>(thread_count);
-    
 public:
-    Simulation(int simulation_width, int simulation_height);
+    Simulation(int window_width, int window_height, int world_width, int world_height);
     ~Simulation() = default;
 
-    inline void updateChunk(int xx, int yy);
-    void updateWorld();
     void draw();
 
-    void renderWorld();
+    // records the session's input to a journal at path; before run()
+    void record(const std::string& path);
+    // plays a journal back at full speed instead of taking input, then closes
+    // the window; the world must be the journal's size. Before run().
+    void replay(JournalReplay* journal_replay);
+    // ticks per second, 0 for as fast as the engine can step; TICK_RATE by default
+    void setTickRate(int ticks_per_second);
+
+    void renderWorld(bool refresh); // refresh: take the newest frame, if any, into the texture
     void renderBrush(); // renders circle around the mouse for brush size
-    void renderChunks(); // for debug purposes
+    void renderChunks(); // for debug purposes, as of the last frame
 
     void run();
     // helper functions
@@ -0,0 +1,258 @@
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "snapshot.h"
+#include "chunkRecords.h"
+
+static const char SNAPSHOT_MAGIC[4] = { 'F', 'S', 'N', 'P' };
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t chunk_size;
+    uint32_t record_count;
+    uint64_t tick;
+    uint64_t seed;
+};
+
+// chunk index, pending rect; the chunk record follows
+static const size_t RECORD_HEADER_SIZE = 4 + sizeof(DirtyRect);
+
+bool saveSnapshot(const Engine& engine, const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "can't open " << path << " for writing" << std::endl;
+        return false;
+    }
+    const World& world = engine.world;
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.width = world.width;
+    header.height = world.height;
+    header.chunk_size = World::chunk_size;
+    header.tick = engine.tick_count;
+    header.seed = engine.rngSeed();
+    // the record count is patched in once all chunks are written
+    file.write((const char*) &header, sizeof(header));
+
+    uint8_t record[RECORD_HEADER_SIZE + MAX_CHUNK_RECORD];
+    for (int yy = 0; yy < world.chunks_height; yy++) {
+        for (int xx = 0; xx < world.chunks_width; xx++) {
+            const World::Chunk* chunk = world.chunkAt(xx, yy);
+            DirtyRect rect = engine.pendingRect(xx, yy);
+            if (!chunk && world.fillAt(xx, yy) == EMPTY_CELL && rect.empty()) continue;
+
+            uint32_t index = xx + yy * world.chunks_width;
+            std::memcpy(record, &index, 4);
+            std::memcpy(record + 4, &rect, sizeof(rect));
+            uint8_t* out = record + RECORD_HEADER_SIZE;
+            size_t size = chunk ? writeChunk(chunk->matrix, chunk->settled, chunk->speeds, out) : writeFill(world.fillAt(xx, yy), out);
+            file.write((const char*) record, RECORD_HEADER_SIZE + size);
+            header.record_count++;
+        }
+    }
+
+    std::vector<uint8_t> sections;
+    writeHeat(engine, sections);
+    writeMotions(engine, sections);
+    file.write((const char*) sections.data(), sections.size());
+
+    file.seekp(offsetof(SnapshotHeader, record_count));
+    file.write((const char*) &header.record_count, sizeof(header.record_count));
+    if (!file) {
+        std::cerr << "failed writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// the settled rows after a materialized chunk's materials, since version 2
+static bool loadSettled(World::Chunk* chunk, const SnapshotHeader& header, const uint8_t*& data, const uint8_t* end) {
+    if (header.version < 2) return true;
+    if (end - data < (long) sizeof(chunk->settled)) return false;
+    std::memcpy(chunk->settled, data, sizeof(chunk->settled));
+    data += sizeof(chunk->settled);
+    chunk->settled_rows = 0;
+    for (int y = 0; y < World::chunk_size; y++) chunk->settled_rows |= (chunk->settled[y] != 0) << y;
+    return true;
+}
+
+// the speeds of a materialized chunk's particles, after its settled rows,
+// since version 5; in older snapshots every particle starts at rest
+static bool loadSpeeds(World::Chunk* chunk, const SnapshotHeader& header, const uint8_t*& data, const uint8_t* end) {
+    if (header.version < 5) return true;
+    return readRuns(data, end, MAX_SPEED + 1, chunk->speeds);
+}
+
+// decodes the records following the header; false if any is malformed
+static bool loadRecords(Engine& engine, const SnapshotHeader& header, const uint8_t*& data, const uint8_t* end) {
+    World& world = engine.world;
+    const int chunk_count = world.chunks_width * world.chunks_height;
+    for (uint32_t r = 0; r < header.record_count; r++) {
+        if (end - data < (long) RECORD_HEADER_SIZE + 2) return false;
+        uint32_t index;
+        DirtyRect rect;
+        std::memcpy(&index, data, 4);
+        std::memcpy(&rect, data + 4, sizeof(rect));
+        uint8_t encoding = data[RECORD_HEADER_SIZE];
+        data += RECORD_HEADER_SIZE + 1;
+        if (index >= (uint32_t) chunk_count) return false;
+        if (!rect.empty() && (rect.max_x >= World::chunk_size || rect.max_y >= World::chunk_size)) return false;
+        int xx = index % world.chunks_width;
+        int yy = index / world.chunks_width;
+
+        if (encoding == FILL_ENCODING) {
+            if (data[0] >= ELEMENT_COUNT) return false;
+            world.fillChunk(xx, yy, ElementType(data[0]));
+            data += 1;
+        } else if (encoding == RLE_ENCODING || encoding == RAW_ENCODING) {
+            World::Chunk* chunk = world.materialize(xx, yy);
+            if (!readMaterials(data, end, encoding, chunk->matrix)) return false;
+            if (!loadSettled(chunk, header, data, end) || !loadSpeeds(chunk, header, data, end)) return false;
+        } else {
+            return false;
+        }
+        engine.markDirtyRect(xx, yy, rect);
+    }
+    return true;
+}
+
+template <typename T>
+static void append(std::vector<uint8_t>& data, const T& value) {
+    data.insert(data.end(), (const uint8_t*) &value, (const uint8_t*) &value + sizeof(value));
+}
+
+void writeHeat(const Engine& engine, std::vector<uint8_t>& out) {
+    std::vector<float> tiles;
+    engine.heat.read(tiles);
+    uint32_t hot_count = 0;
+    for (float t : tiles) hot_count += t != 0;
+    append(out, hot_count);
+    for (uint32_t i = 0; i < tiles.size(); i++) {
+        if (tiles[i] == 0) continue;
+        append(out, i);
+        append(out, tiles[i]);
+    }
+}
+
+bool readHeat(Engine& engine, const uint8_t*& data, const uint8_t* end) {
+    uint32_t count;
+    if (end - data < (long) sizeof(count)) return false;
+    std::memcpy(&count, data, sizeof(count));
+    data += sizeof(count);
+    std::vector<float> tiles(size_t(engine.heat.tiles_width) * engine.heat.tiles_height, 0);
+    if (count > tiles.size() || end - data < (long) count * 8) return false;
+    for (uint32_t i = 0; i < count; i++, data += 8) {
+        uint32_t index;
+        float temperature;
+        std::memcpy(&index, data, 4);
+        std::memcpy(&temperature, data + 4, 4);
+        if (index >= tiles.size() || !(temperature >= 0)) return false;
+        tiles[index] = temperature;
+    }
+    engine.heat.write(tiles);
+    return true;
+}
+
+void writeMotions(const Engine& engine, std::vector<uint8_t>& out) {
+    std::vector<RigidBodies::Motion> motions;
+    engine.bodies.read(motions);
+    append(out, uint32_t(motions.size()));
+    for (const RigidBodies::Motion& motion : motions) append(out, motion);
+}
+
+bool readMotions(Engine& engine, const uint8_t*& data, const uint8_t* end) {
+    uint32_t count;
+    if (end - data < (long) sizeof(count)) return false;
+    std::memcpy(&count, data, sizeof(count));
+    data += sizeof(count);
+    if ((unsigned long) (end - data) / sizeof(RigidBodies::Motion) < count) return false;
+    std::vector<RigidBodies::Motion> motions(count);
+    if (count) std::memcpy(motions.data(), data, count * sizeof(RigidBodies::Motion));
+    data += count * sizeof(RigidBodies::Motion);
+    engine.bodies.write(motions);
+    return true;
+}
+
+// the temperatures following the records, since version 3; older snapshots
+// start at ambient
+static bool loadHeat(Engine& engine, const SnapshotHeader& header, const uint8_t*& data, const uint8_t* end) {
+    return header.version < 3 || readHeat(engine, data, end);
+}
+
+// the motion of the falling rigid bodies, since version 4; in older snapshots
+// every body starts at rest
+static bool loadBodies(Engine& engine, const SnapshotHeader& header, const uint8_t* data, const uint8_t* end) {
+    return header.version < 4 || readMotions(engine, data, end);
+}
+
+bool loadSnapshot(Engine& engine, const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "can't open " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < (off_t) sizeof(SnapshotHeader)) {
+        std::cerr << path << " is not a snapshot" << std::endl;
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "can't map " << path << std::endl;
+        return false;
+    }
+    const uint8_t* data = (const uint8_t*) mapping;
+
+    SnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    bool ok = false;
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))) {
+        std::cerr << path << " is not a snapshot" << std::endl;
+    } else if (header.version < 1 || header.version > SNAPSHOT_VERSION) {
+        std::cerr << path << " is snapshot version " << header.version << ", expected at most " << SNAPSHOT_VERSION << std::endl;
+    } else if (header.width != (uint32_t) engine.world.width || header.height != (uint32_t) engine.world.height
+            || header.chunk_size != World::chunk_size) {
+        std::cerr << path << " holds a " << header.width << "x" << header.height << " world, expected "
+                  << engine.world.width << "x" << engine.world.height << std::endl;
+    } else {
+        engine.reset();
+        engine.clearDirty();
+        engine.tick_count = header.tick;
+        engine.seed(header.seed);
+        const uint8_t* records = data + sizeof(header);
+        ok = loadRecords(engine, header, records, data + info.st_size)
+            && loadHeat(engine, header, records, data + info.st_size)
+            && loadBodies(engine, header, records, data + info.st_size);
+        if (!ok) {
+            std::cerr << path << " is corrupt" << std::endl;
+            engine.reset();
+        }
+    }
+    munmap(mapping, info.st_size);
+    return ok;
+}
+
+bool snapshotSize(const std::string& path, int& width, int& height) {
+    std::ifstream file(path, std::ios::binary);
+    SnapshotHeader header;
+    if (!file.read((char*) &header, sizeof(header)) || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic))) {
+        std::cerr << path << " is not a snapshot" << std::endl;
+        return false;
+    }
+    width = header.width;
+    height = header.height;
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "engine.h"
+
+// Binary snapshots of an engine: the world, the pending dirty rects, the tick
+// and the seed, which is everything the next tick depends on, so a loaded
+// snapshot continues exactly like the run it was saved from.
+//
+// Layout, in host (little endian) byte order:
+//   header   magic "FSNP", version, width, height, chunk_size, record count,
+//            tick, seed
+//   records  one per chunk that is not empty and idle, in chunk order:
+//            chunk index (u32), pending rect (4 x u8), encoding (u8), then
+//              FILL  the material of a chunk that owns no planes (u8)
+//              RLE   payload size (u16), then (run length - 1, material) pairs
+//              RAW   chunk_area materials
+//            and for RLE and RAW, the chunk's settled rows (chunk_size x u16),
+//            since version 2, then its particle speeds as payload size (u16)
+//            and (run length - 1, speed) pairs, since version 5
+//   heat     since version 3: count (u32), then (tile index (u32),
+//            temperature (f32)) for each tile of the heat field above ambient
+//   bodies   since version 4: count (u32), then a cell, the speed and the
+//            travel (4 x i32) of each falling rigid body
+//
+// Chunks are written one at a time, so saving needs no buffer the size of the
+// world. Loading maps the file and decodes straight into the chunk planes.
+// Version 1 snapshots, without settled rows, still load; their cells all start
+// unsettled, so they continue like the run only up to which cells step first.
+// Older versions start with the heat field at ambient and every rigid body and
+// particle at rest.
+const uint32_t SNAPSHOT_VERSION = 5;
+
+// both return false, after printing why, if the file can't be used. A failed
+// load leaves the engine reset.
+bool saveSnapshot(const Engine& engine, const std::string& path);
+bool loadSnapshot(Engine& engine, const std::string& path);
+
+// The heat and bodies sections above, which region store manifests keep too.
+// The readers move data past what they read and return false if it is
+// malformed; readMotions() is for after the world is loaded.
+void writeHeat(const Engine& engine, std::vector<uint8_t>& out);
+bool readHeat(Engine& engine, const uint8_t*& data, const uint8_t* end);
+void writeMotions(const Engine& engine, std::vector<uint8_t>& out);
+bool readMotions(Engine& engine, const uint8_t*& data, const uint8_t* end);
+
+// reads the world dimensions of a snapshot, so an engine of the right size can
+// be made to load it into
+bool snapshotSize(const std::string& path, int& width, int& height);
@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer
+// thread, such as input going from the window thread to the simulation thread.
+// The producer only ever writes tail and the consumer only head, so neither
+// side takes a lock or waits on the other.
+template <typename T, size_t capacity>
+class SpscQueue {
+    static_assert(capacity && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // producer only; false if the queue is full
+    bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == capacity) return false;
+        items[t & (capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only; false if the queue is empty
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h & (capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[capacity];
+    alignas(64) std::atomic<size_t> head; // next item to pop
+    alignas(64) std::atomic<size_t> tail; // next slot to push
+};
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include "threadPool.h"
+
+static uint64_t packRange(uint32_t begin, uint32_t end) {
+    return uint64_t(end) << 32 | begin;
+}
+
+ThreadPool::ThreadPool(int thread_count) :
+    shares(thread_count)
+{
+#ifdef SAND_PROFILE
+    busy.resize(thread_count);
+#endif
+    for (Share& share : shares) share.range.store(0, std::memory_order_relaxed);
+    for (int t = 1; t < thread_count; t++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, t);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start_condition.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::parallelFor(int count, const Job& job) {
+#ifdef SAND_PROFILE
+    uint64_t start = Profiler::now();
+    for (uint64_t& ns : busy) ns = 0;
+    stolen.store(0, std::memory_order_relaxed);
+#endif
+    if (workers.empty() || count <= 1) {
+        for (int i = 0; i < count; i++) job(i, 0);
+#ifdef SAND_PROFILE
+        busy[0] = Profiler::now() - start;
+        reportBusy(start);
+#endif
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = &job;
+        const int threads = size();
+        for (int t = 0; t < threads; t++) {
+            shares[t].range.store(packRange(uint64_t(count) * t / threads, uint64_t(count) * (t + 1) / threads), std::memory_order_relaxed);
+        }
+        pending_workers = workers.size();
+        generation++;
+    }
+    start_condition.notify_all();
+
+    runTasks(0);
+
+    // barrier: wait for the workers to drain the remaining tasks
+    std::unique_lock<std::mutex> lock(mutex);
+    done_condition.wait(lock, [this] { return pending_workers == 0; });
+#ifdef SAND_PROFILE
+    PROFILE_COUNTER("stolen tasks", stolen.load(std::memory_order_relaxed));
+    reportBusy(start);
+#endif
+}
+
+#ifdef SAND_PROFILE
+void ThreadPool::reportBusy(uint64_t start) {
+    uint64_t wall = Profiler::now() - start;
+    for (int t = 0; t < size(); t++) {
+        PROFILE_THREAD_COUNTER("busy ns", busy[t], t);
+        PROFILE_THREAD_COUNTER("idle ns", wall - std::min(busy[t], wall), t);
+    }
+}
+#endif
+
+void ThreadPool::workerLoop(int thread) {
+    int seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_condition.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        runTasks(thread);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending_workers == 0) done_condition.notify_one();
+    }
+}
+
+int ThreadPool::take(int thread) {
+    std::atomic<uint64_t>& range = shares[thread].range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t begin = current, end = current >> 32;
+        if (begin >= end) return -1;
+        if (range.compare_exchange_weak(current, packRange(begin + 1, end), std::memory_order_acq_rel)) return begin;
+    }
+}
+
+int ThreadPool::steal(int thread) {
+    const int threads = size();
+    for (int offset = 1; offset < threads; offset++) {
+        std::atomic<uint64_t>& victim = shares[(thread + offset) % threads].range;
+        uint64_t current = victim.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t begin = current, end = current >> 32;
+            if (begin >= end) break;
+            uint32_t split = end - (end - begin + 1) / 2;
+            if (!victim.compare_exchange_weak(current, packRange(begin, split), std::memory_order_acq_rel)) continue;
+            // the thread's own share is empty, so no one else writes it now
+            shares[thread].range.store(packRange(split + 1, end), std::memory_order_release);
+#ifdef SAND_PROFILE
+            stolen.fetch_add(end - split, std::memory_order_relaxed);
+#endif
+            return split;
+        }
+    }
+    return -1;
+}
+
+void ThreadPool::runTasks(int thread) {
+#ifdef SAND_PROFILE
+    PROFILE_SCOPE("tasks");
+    uint64_t start = Profiler::now();
+#endif
+    int task;
+    while ((task = take(thread)) >= 0 || (task = steal(thread)) >= 0) {
+        (*job)(task, thread);
+    }
+#ifdef SAND_PROFILE
+    busy[thread] = Profiler::now() - start;
+#endif
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "profiler.h"
+
+// A fixed set of persistent worker threads. parallelFor() hands the task
+// indices [0, count) out to the workers and to the calling thread, and only
+// returns once every task is finished, so consecutive calls are separated by a
+// barrier. Threads are created once, never per call. When profiling, each call
+// reports how long every thread was busy on tasks and idle at the barrier.
+//
+// Tasks are scheduled by work stealing: every thread starts on its own
+// contiguous share of the indices, so neighbouring tasks (chunks next to each
+// other) stay on one core, and takes them from the front. A thread that runs
+// out steals the back half of the share of another one, so a cluster of slow
+// tasks is spread over every thread rather than holding up the barrier.
+class ThreadPool {
+public:
+    using Job = std::function<void(int task, int thread)>;
+
+    // thread_count includes the calling thread, so 1 means no workers at all
+    ThreadPool(int thread_count);
+    ~ThreadPool();
+
+    int size() const { return workers.size() + 1; }
+
+    // thread is in [0, size()), 0 being the calling thread
+    void parallelFor(int count, const Job& job);
+
+private:
+    void workerLoop(int thread);
+    void runTasks(int thread);
+    int take(int thread);  // next task of the thread's own share, or -1
+    int steal(int thread); // moves half of another share to the thread's own, or -1
+#ifdef SAND_PROFILE
+    void reportBusy(uint64_t start);
+#endif
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_condition;
+    std::condition_variable done_condition;
+    const Job* job = nullptr;
+
+    // per thread, the tasks left of its share: the next one in the low 32 bits
+    // and the end in the high ones, so taking and stealing are one CAS each
+    struct alignas(64) Share {
+        std::atomic<uint64_t> range;
+    };
+    std::vector<Share> shares;
+    int generation = 0; // bumped for every parallelFor call
+    int pending_workers = 0;
+    bool stopping = false;
+
+#ifdef SAND_PROFILE
+    std::vector<uint64_t> busy; // ns each thread spent on tasks in the current call
+    std::atomic<int> stolen;    // tasks moved by steals in the current call
+#endif
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// Paces ticks at a fixed rate, apart from how fast frames are drawn. The owner
+// asks due() how many ticks to run now: none while it is early, one when on
+// time, several in a row when it fell behind, up to max_substeps. Lateness
+// past that is dropped rather than carried, so a world too heavy for the rate
+// runs slower than real time instead of falling further behind every frame.
+//
+// A rate of 0 means unlimited: every call is due one tick, so ticks run back to
+// back as fast as the engine can step them.
+class FixedTimestep {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FixedTimestep(double ticks_per_second = 0, int max_substeps = 8) :
+        max_substeps(std::max(max_substeps, 1))
+    {
+        dropped = 0;
+        setRate(ticks_per_second);
+    }
+
+    // restarts the pacing from now
+    void setRate(double ticks_per_second) {
+        tick_rate = std::max(ticks_per_second, 0.);
+        interval = tick_rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / tick_rate)) : Clock::duration::zero();
+        next = Clock::now();
+    }
+    double rate() const { return tick_rate; }
+
+    int due() {
+        if (tick_rate == 0) return 1;
+        Clock::time_point now = Clock::now();
+        if (now < next) return 0;
+        long behind = 1 + (now - next) / interval;
+        if (behind > max_substeps) {
+            dropped += behind - max_substeps;
+            next = now + interval;
+            return max_substeps;
+        }
+        next += behind * interval;
+        return behind;
+    }
+
+    // sleeps until the next tick is due, but no longer than at_most, so the
+    // caller can still look at its input meanwhile
+    void wait(Clock::duration at_most) const {
+        if (tick_rate == 0) return;
+        std::this_thread::sleep_until(std::min(next, Clock::now() + at_most));
+    }
+
+    long dropped; // ticks skipped because they were more than max_substeps late
+
+private:
+    const int max_substeps;
+    double tick_rate;
+    Clock::duration interval;
+    Clock::time_point next; // when the next tick is due
+};
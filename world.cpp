@@ -1,25 +1,175 @@
 #include <cstring>
 #include <iostream>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "elementUtils.h"
 #include "world.h"
 
-World::World() {
+World::World(int width, int height) :
+    width(width),
+    height(height),
+    size(width * height),
+    chunks_width(width / chunk_size),
+    chunks_height(height / chunk_size),
+    random_key(0),
+    reaction_key(0),
+    epoch(0),
+    chunks(chunks_width * chunks_height),
+    fills(chunks_width * chunks_height, EMPTY_CELL),
+    allocated_chunks(0)
+{
     reset();
 }
 
-World::~World() {}
+World::~World() {
+    reset();
+}
+
+World::Chunk* World::materialize(int xx, int yy) {
+    std::atomic<Chunk*>& slot = chunks[xx + yy * chunks_width];
+    Chunk* chunk = slot.load(std::memory_order_acquire);
+    if (chunk) return chunk;
+
+    Chunk* fresh = new Chunk;
+    memset(fresh->matrix, fills[xx + yy * chunks_width], sizeof(fresh->matrix));
+    memset(fresh->epochs, 0, sizeof(fresh->epochs));
+    memset(fresh->speeds, 0, sizeof(fresh->speeds));
+    memset(fresh->settled, 0, sizeof(fresh->settled));
+    fresh->settled_rows = 0;
+    // two chunks of one phase may both spill into this one
+    if (!slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+        delete fresh;
+        return chunk;
+    }
+    allocated_chunks.fetch_add(1, std::memory_order_relaxed);
+    return fresh;
+}
+
+bool World::compact(int xx, int yy) {
+    Chunk* chunk = chunkAt(xx, yy);
+    if (!chunk) return true;
+    for (int i = 1; i < chunk_area; i++) {
+        if (chunk->matrix[i] != chunk->matrix[0]) return false;
+    }
+    fills[xx + yy * chunks_width] = chunk->matrix[0];
+    chunks[xx + yy * chunks_width].store(nullptr, std::memory_order_relaxed);
+    allocated_chunks.fetch_sub(1, std::memory_order_relaxed);
+    delete chunk;
+    return true;
+}
+
+void World::fillChunk(int xx, int yy, ElementType e) {
+    Chunk* chunk = chunks[xx + yy * chunks_width].exchange(nullptr, std::memory_order_relaxed);
+    if (chunk) {
+        allocated_chunks.fetch_sub(1, std::memory_order_relaxed);
+        delete chunk;
+    }
+    fills[xx + yy * chunks_width] = e;
+}
+
+size_t World::memoryUsage() const {
+    return allocatedChunks() * sizeof(Chunk) + chunks.size() * (sizeof(chunks[0]) + sizeof(fills[0]));
+}
 
 ElementType World::getElementAtPosition(int x, int y) {
     if (!inBounds(x, y)) return NULL_ELEMENT;
-    return static_cast<ElementType>(matrix[x + y * width] & 0xFF);
+    Chunk* chunk = chunkAt(x >> chunk_shift, y >> chunk_shift);
+    return chunk ? chunk->matrix[localIndex(x, y)] : fillAt(x >> chunk_shift, y >> chunk_shift);
 }
 
 void World::swapElementsAtPositions(int x1, int y1, int x2, int y2) {
-    std::swap(matrix[x1 + y1 * width], matrix[x2 + y2 * width]);
+    swapCells(materialize(x1 >> chunk_shift, y1 >> chunk_shift), localIndex(x1, y1),
+              materialize(x2 >> chunk_shift, y2 >> chunk_shift), localIndex(x2, y2));
+    unsettle(std::min(x1, x2) - 1, std::min(y1, y2) - 1, std::max(x1, x2) + 1, std::max(y1, y2) + 1);
+}
+
+void World::swapCells(Chunk* a, int i, Chunk* b, int j) {
+    std::swap(a->matrix[i], b->matrix[j]);
+    std::swap(a->epochs[i], b->epochs[j]);
+    std::swap(a->speeds[i], b->speeds[j]);
+}
+
+void World::unsettle(int min_x, int min_y, int max_x, int max_y, const Chunk* skip) {
+    const int mask = chunk_size - 1;
+    min_x = std::max(min_x, 0);
+    min_y = std::max(min_y, 0);
+    max_x = std::min(max_x, width - 1);
+    max_y = std::min(max_y, height - 1);
+    // chunk by chunk, the box spans at most 2 by 2 of them
+    for (int yy = min_y >> chunk_shift; yy <= max_y >> chunk_shift; yy++) {
+        int first_y = std::max(min_y, yy << chunk_shift) & mask;
+        int last_y = std::min(max_y, (yy << chunk_shift) | mask) & mask;
+        for (int xx = min_x >> chunk_shift; xx <= max_x >> chunk_shift; xx++) {
+            Chunk* chunk = chunkAt(xx, yy);
+            if (!chunk || chunk == skip || !(chunk->settled_rows >> first_y & ((2u << (last_y - first_y)) - 1))) continue;
+            int first_x = std::max(min_x, xx << chunk_shift) & mask;
+            int last_x = std::min(max_x, (xx << chunk_shift) | mask) & mask;
+            uint16_t keep = ~(((2u << last_x) - 1) & ~((1u << first_x) - 1));
+            for (int y = first_y; y <= last_y; y++) {
+                if (__atomic_load_n(&chunk->settled[y], __ATOMIC_RELAXED) & ~keep) __atomic_fetch_and(&chunk->settled[y], keep, __ATOMIC_RELAXED);
+            }
+        }
+    }
 }
 
+#if defined(__AVX2__)
+// two rows per register: look the materials up in a byte table of active
+// elements, then drop the cells already stamped with epoch
+void World::candidateRows(const Chunk* chunk, uint8_t epoch, uint16_t rows[chunk_size]) {
+    static_assert(chunk_size == 16 && ELEMENT_COUNT <= 16, "rows must be 16 cells and materials fit a nibble");
+    alignas(16) int8_t table[16];
+    for (int e = 0; e < 16; e++) table[e] = ACTIVE_ELEMENTS >> e & 1 ? -1 : 0;
+    const __m256i active = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) table));
+    const __m256i stamp = _mm256_set1_epi8(epoch);
+    for (int y = 0; y < chunk_size; y += 2) {
+        __m256i materials = _mm256_loadu_si256((const __m256i*) (chunk->matrix + y * chunk_size));
+        __m256i epochs = _mm256_loadu_si256((const __m256i*) (chunk->epochs + y * chunk_size));
+        __m256i candidates = _mm256_andnot_si256(_mm256_cmpeq_epi8(epochs, stamp), _mm256_shuffle_epi8(active, materials));
+        uint32_t bits = _mm256_movemask_epi8(candidates);
+        rows[y] = bits;
+        rows[y + 1] = bits >> 16;
+    }
+}
+#elif defined(__SSE2__)
+// one row per register, testing each active element in turn
+void World::candidateRows(const Chunk* chunk, uint8_t epoch, uint16_t rows[chunk_size]) {
+    static_assert(chunk_size == 16, "rows must fill a register");
+    const __m128i stamp = _mm_set1_epi8(epoch);
+    for (int y = 0; y < chunk_size; y++) {
+        __m128i materials = _mm_loadu_si128((const __m128i*) (chunk->matrix + y * chunk_size));
+        __m128i epochs = _mm_loadu_si128((const __m128i*) (chunk->epochs + y * chunk_size));
+        __m128i candidates = _mm_setzero_si128();
+        for (int e = 0; e < ELEMENT_COUNT; e++) {
+            if (ACTIVE_ELEMENTS >> e & 1) candidates = _mm_or_si128(candidates, _mm_cmpeq_epi8(materials, _mm_set1_epi8(e)));
+        }
+        rows[y] = _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(epochs, stamp), candidates));
+    }
+}
+#else
+void World::candidateRows(const Chunk* chunk, uint8_t epoch, uint16_t rows[chunk_size]) {
+    for (int y = 0; y < chunk_size; y++) {
+        uint16_t bits = 0;
+        for (int x = 0; x < chunk_size; x++) {
+            int i = y * chunk_size + x;
+            if (ACTIVE_ELEMENTS >> chunk->matrix[i] & 1 && chunk->epochs[i] != epoch) bits |= 1 << x;
+        }
+        rows[y] = bits;
+    }
+}
+#endif
+
 void World::setElementAtPosition(int x, int y, ElementType e) {
-    matrix[x + y * width] = e;
+    Chunk* chunk = chunkAt(x >> chunk_shift, y >> chunk_shift);
+    if (!chunk) {
+        if (fillAt(x >> chunk_shift, y >> chunk_shift) == e) return;
+        chunk = materialize(x >> chunk_shift, y >> chunk_shift);
+    } else if (chunk->matrix[localIndex(x, y)] == e) {
+        return;
+    }
+    chunk->matrix[localIndex(x, y)] = e;
+    chunk->speeds[localIndex(x, y)] = 0;
+    unsettle(x - 1, y - 1, x + 1, y + 1);
 }
 
 // ONLY to be used AFTER all cells are initialized 
@@ -29,81 +179,281 @@ void World::spawnElementAtPosition(int x, int y, ElementType e) {
     }
 }
 
-void World::reset() {
-    memset(matrix, 0, sizeof(matrix));
-}
-
-bool World::update(int x, int y) {
-    ElementType e = static_cast<ElementType>(matrix[x + y * width] & 0xFF);
-    ElementType o;
-    switch (e) {
-        case EMPTY_CELL:
-            return false;
-            break;
-
-        case IMMOVEABLE_SOLID:
-            return false;
-            break;
-
-        case SAND:
-            o = getElementAtPosition(x, y + 1);
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x, y + 1);
-                return true;
-            }
-            o = getElementAtPosition(x + (fiftyFifty() ? 1 : -1), y + 1);       
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x + (fiftyFifty() ? 1 : -1), y + 1);
-                return true;
+int World::fillSpan(int x1, int x2, int y, ElementType e, ElementType only) {
+    if (y < 0 || y >= height) return 0;
+    x1 = std::max(x1, 0);
+    x2 = std::min(x2, width - 1);
+    const int mask = chunk_size - 1;
+    int changed = 0;
+    for (int x = x1; x <= x2;) {
+        int xx = x >> chunk_shift;
+        int end = std::min(x2, x | mask);
+        Chunk* chunk = chunkAt(xx, y >> chunk_shift);
+        if (!chunk) {
+            ElementType fill = fillAt(xx, y >> chunk_shift);
+            if (fill == e || (only != NULL_ELEMENT && fill != only)) {
+                x = end + 1;
+                continue;
             }
-            o = getElementAtPosition(x + (!fiftyFifty() ? 1 : -1), y + 1);       
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x + (!fiftyFifty() ? 1 : -1), y + 1);
-                return true;
-            }
-            break;
-        
-        case WATER:
-            o = getElementAtPosition(x, y + 1);
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x, y + 1);
-                return true;
-            }
-            o = getElementAtPosition(x + (fiftyFifty() ? 1 : -1), y + 1);       
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x + (fiftyFifty() ? 1 : -1), y + 1);
-                return true;
-            }
-            o = getElementAtPosition(x + (!fiftyFifty() ? 1 : -1), y + 1);       
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x + (!fiftyFifty() ? 1 : -1), y + 1);
-                return true;
-            }
-            o = getElementAtPosition(x + (fiftyFifty() ? 1 : -1), y);       
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x + (fiftyFifty() ? 1 : -1), y);
-                return true;
-            }
-            o = getElementAtPosition(x + (!fiftyFifty() ? 1 : -1), y);       
-            if (o != NULL_ELEMENT && PROPERTIES[o].density < PROPERTIES[e].density) {
-                swapElementsAtPositions(x, y, x + (!fiftyFifty() ? 1 : -1), y);
-                return true;
-            }
-            break;
+            chunk = materialize(xx, y >> chunk_shift);
+        }
+        ElementType* row = chunk->matrix + localIndex(0, y);
+        for (int local_x = x & mask; local_x <= (end & mask); local_x++) {
+            if (row[local_x] == e || (only != NULL_ELEMENT && row[local_x] != only)) continue;
+            row[local_x] = e;
+            chunk->speeds[localIndex(local_x, y)] = 0;
+            changed++;
+        }
+        x = end + 1;
+    }
+    return changed;
+}
 
-        case GAS:
+void World::reset() {
+    for (int i = 0; i < chunks_width * chunks_height; i++) {
+        delete chunks[i].exchange(nullptr, std::memory_order_relaxed);
+        fills[i] = EMPTY_CELL;
+    }
+    allocated_chunks.store(0, std::memory_order_relaxed);
+}
+
+void World::clearEpochs() {
+    for (int i = 0; i < chunks_width * chunks_height; i++) {
+        Chunk* chunk = chunks[i].load(std::memory_order_relaxed);
+        if (chunk) memset(chunk->epochs, 0, sizeof(chunk->epochs));
+    }
+}
+
+void World::clearSpeeds() {
+    for (int i = 0; i < chunks_width * chunks_height; i++) {
+        Chunk* chunk = chunks[i].load(std::memory_order_relaxed);
+        if (chunk) memset(chunk->speeds, 0, sizeof(chunk->speeds));
+    }
+}
+
+uint64_t World::hash() {
+    uint64_t h = 14695981039346656037ULL;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            h ^= getElementAtPosition(x, y);
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
 
-        case ACID:
+// Updates of one checkerboard phase are two chunks apart, so a particle must
+// never reach more than half a chunk into its neighbours.
+constexpr int maxReach() {
+    int reach = 1;
+    for (int e = 0; e < ELEMENT_COUNT; e++) {
+        MovementRules rules = movementRules(ElementType(e));
+        reach = std::max({ reach, rules.dispersion, rules.max_speed });
+    }
+    return reach;
+}
+static_assert(maxReach() <= World::chunk_size / 2, "moves reach into cells of another chunk of the same phase");
+static_assert(MAX_SPEED <= 0xFF, "speeds are stored in a byte");
+
+// Movement kernels, instantiated per material from its MovementRules. Interior
+// kernels serve cells whose 8 neighbours share their chunk: neighbours are read
+// and swapped through the chunk planes with no bounds checks. Border kernels run
+// the same rules through the bounds checked world accessors.
+template <ElementType E>
+static bool displaces(ElementType o) {
+    return (DISPLACES[E] >> (o & 31)) & 1;
+}
+
+// how many cells, up to limit, the particle at (x, y) can travel in steps of
+// (dx, dy) through cells of the materials in through, a mask like DISPLACES
+template <bool interior>
+static int travel(World& world, World::Chunk* chunk, int x, int y, int dx, int dy, int limit, uint32_t through) {
+    int n = 0;
+    if constexpr (interior) {
+        // the part of the way inside the chunk needs no checks once clamped
+        const int mask = World::chunk_size - 1;
+        int local_x = x & mask, local_y = y & mask;
+        int inside = limit;
+        if (dx) inside = std::min(inside, dx > 0 ? mask - local_x : local_x);
+        if (dy) inside = std::min(inside, dy > 0 ? mask - local_y : local_y);
+        const ElementType* cell = chunk->matrix + World::localIndex(x, y);
+        const int stride = dx + dy * World::chunk_size;
+        while (n < inside && (through >> (cell[(n + 1) * stride] & 31) & 1)) n++;
+        if (n < inside) return n;
+    }
+    while (n < limit && (through >> (world.getElementAtPosition(x + (n + 1) * dx, y + (n + 1) * dy) & 31) & 1)) n++;
+    return n;
+}
 
-        case WOOD:
+enum ReactionResult { INERT, WAITING, REACTED };
 
-        case FIRE:
+// Rolls the reactions of a cell of E with its 4 neighbours, then its decay.
+// Every roll is drawn, looked up and compared before any is acted on, so the
+// only branch taken per material pair is whether anything happened at all.
+// WAITING means nothing did but something may on a later tick.
+template <ElementType E, bool interior>
+static ReactionResult react(World& world, World::Chunk* chunk, int x, int y, DirtyBox& dirty) {
+    constexpr int offsets[4][2] = { { 0, 1 }, { -1, 0 }, { 1, 0 }, { 0, -1 } };
+    constexpr uint16_t decay = decayChance(E);
+    constexpr uint32_t roll = REACTION_CERTAIN - 1;
+    static_assert(5 * REACTION_BITS + 2 <= 64, "the rolls and the pick share one random number");
+    const int i = World::localIndex(x, y);
 
-        case LAVA:
+    ElementType neighbours[4];
+    uint32_t present = 0;
+    for (int k = 0; k < 4; k++) {
+        int dx = offsets[k][0], dy = offsets[k][1];
+        if constexpr (interior) neighbours[k] = chunk->matrix[i + dx + dy * World::chunk_size];
+        else neighbours[k] = world.getElementAtPosition(x + dx, y + dy);
+        present |= 1u << (neighbours[k] & 31);
+    }
+    // most cells have nothing to react with, and don't need to roll
+    if (!(present & REACTIONS.partners[E]) && !decay) return INERT;
+
+    uint64_t r = randomAt(world.reaction_key, x + y * world.width);
+    uint32_t fired = 0;
+    for (int k = 0; k < 4; k++) {
+        fired |= uint32_t((r >> (k * REACTION_BITS) & roll) < REACTIONS[E][neighbours[k] & 31].chance) << k;
+    }
+
+    // cells a reaction makes wait for the next tick to step
+    auto set = [&](int dx, int dy, ElementType e) {
+        int nx = x + dx, ny = y + dy;
+        bool inside = interior || ((nx ^ x) | (ny ^ y)) >> World::chunk_shift == 0;
+        World::Chunk* target = inside ? chunk : world.materialize(nx >> World::chunk_shift, ny >> World::chunk_shift);
+        int j = World::localIndex(nx, ny);
+        target->matrix[j] = e;
+        target->epochs[j] = world.epoch;
+        target->speeds[j] = 0;
+        World::unsettleWithin(chunk, x >> World::chunk_shift, y >> World::chunk_shift, nx - 1, ny - 1, nx + 1, ny + 1);
+        dirty.include(nx, ny);
+    };
+
+    if (fired) {
+        // of several neighbours that reacted, the one that wins is drawn too,
+        // so no side is favoured
+        int start = r >> 62;
+        int k = (__builtin_ctz((fired | fired << 4) >> start) + start) & 3;
+        const Reaction& reaction = REACTIONS[E][neighbours[k] & 31];
+        if (reaction.neighbour_into != neighbours[k]) set(offsets[k][0], offsets[k][1], reaction.neighbour_into);
+        if (reaction.actor_into != E) set(0, 0, reaction.actor_into);
+        return REACTED;
+    }
+    if constexpr (decay > 0) {
+        if ((r >> (4 * REACTION_BITS) & roll) < decay) {
+            set(0, 0, EMPTY_CELL);
+            return REACTED;
+        }
+    }
+    return WAITING;
+}
+
+template <ElementType E, bool interior>
+static bool step(World& world, World::Chunk* chunk, int x, int y, DirtyBox& dirty) {
+    constexpr MovementRules rules = movementRules(E);
+    constexpr int dy = rules.direction;
+    constexpr bool carries = rules.max_speed > 1; // whether the particle has a speed at all
+    constexpr uint32_t empty = 1u << EMPTY_CELL;
+    const int i = World::localIndex(x, y);
+
+    // a reaction takes the place of moving this tick
+    bool waiting = false;
+    if constexpr (reacts(E)) {
+        ReactionResult result = react<E, interior>(world, chunk, x, y, dirty);
+        if (result == REACTED) return true;
+        waiting = result == WAITING;
+    }
+
+    auto at = [&](int dx, int dy) {
+        if constexpr (interior) return chunk->matrix[i + dx + dy * World::chunk_size];
+        else return world.getElementAtPosition(x + dx, y + dy);
+    };
+    auto move = [&](int dx, int dy) {
+        // a long move may carry an interior particle out of its chunk
+        bool inside = interior && unsigned((x & (World::chunk_size - 1)) + dx) < unsigned(World::chunk_size)
+                               && unsigned((y & (World::chunk_size - 1)) + dy) < unsigned(World::chunk_size);
+        if (inside) World::swapCells(chunk, i, chunk, i + dx + dy * World::chunk_size);
+        else World::swapCells(chunk, i, world.materialize((x + dx) >> World::chunk_shift, (y + dy) >> World::chunk_shift), World::localIndex(x + dx, y + dy));
+        // the engine unsettles other chunks once this one is done
+        World::unsettleWithin(chunk, x >> World::chunk_shift, y >> World::chunk_shift,
+                              std::min(x, x + dx) - 1, std::min(y, y + dy) - 1, std::max(x, x + dx) + 1, std::max(y, y + dy) + 1);
+        dirty.include(x, y);
+        dirty.include(x + dx, y + dy);
+        return true;
+    };
+    // the speed left after landing or moving sideways
+    auto slowed = [](int speed) {
+        return std::max(speed - std::max(speed * rules.friction / 10, 1), 0);
+    };
+
+    if constexpr (dy != 0) {
+        const int speed = carries ? chunk->speeds[i] : 0;
+        const ElementType below = at(0, dy);
+        if (displaces<E>(below)) {
+            int n = 1;
+            if constexpr (carries) {
+                // free fall speeds up; falling into anything but empty cells
+                // brakes to a crawl
+                int fall = below == EMPTY_CELL ? std::min(speed + 1, rules.max_speed) : 1;
+                if (fall > 1) n = travel<interior>(world, chunk, x, y, 0, dy, fall, empty);
+                chunk->speeds[i] = n < fall ? fall * (10 - rules.friction) / 10 : fall;
+            }
+            return move(0, n * dy);
+        }
+
+        // which side a particle tries first when sliding and when dispersing. Only
+        // drawn once moving straight failed, most particles never need it.
+        uint64_t r = randomAt(world.random_key, x + y * world.width);
+        if constexpr (rules.slides) {
+            int side = r & 1 ? 1 : -1;
+            for (int k = 0; k < 2; k++, side = -side) {
+                ElementType diagonal = at(side, dy);
+                if (!displaces<E>(diagonal)) continue;
+                int n = 1;
+                if constexpr (carries) {
+                    if (speed > 1 && diagonal == EMPTY_CELL) n = travel<interior>(world, chunk, x, y, side, dy, speed, empty);
+                    chunk->speeds[i] = slowed(speed);
+                }
+                return move(n * side, n * dy);
+            }
+        }
+        if constexpr (rules.dispersion > 0) {
+            int reach = std::max(rules.dispersion, speed);
+            int flow = r & 2 ? 1 : -1;
+            for (int k = 0; k < 2; k++, flow = -flow) {
+                int n = travel<interior>(world, chunk, x, y, flow, 0, reach, DISPLACES[E]);
+                if (!n) continue;
+                if constexpr (carries) chunk->speeds[i] = slowed(speed);
+                return move(n * flow, 0);
+            }
+        }
+        if constexpr (carries) chunk->speeds[i] = 0;
+    }
+    // stepped again next tick to roll again
+    if (waiting) dirty.include(x, y);
+    return waiting;
+}
+
+template <ElementType E>
+static bool stepMaterial(World& world, World::Chunk* chunk, int x, int y, DirtyBox& dirty) {
+    int local_x = x & (World::chunk_size - 1);
+    int local_y = y & (World::chunk_size - 1);
+    if (local_x > 0 && local_x < World::chunk_size - 1 && local_y > 0 && local_y < World::chunk_size - 1) {
+        return step<E, true>(world, chunk, x, y, dirty);
+    }
+    return step<E, false>(world, chunk, x, y, dirty);
+}
 
-        return false;
+bool World::update(Chunk* chunk, int x, int y, DirtyBox& dirty) {
+    switch (chunk->matrix[localIndex(x, y)]) {
+        case SAND:  return stepMaterial<SAND>(*this, chunk, x, y, dirty);
+        case WATER: return stepMaterial<WATER>(*this, chunk, x, y, dirty);
+        case GAS:   return stepMaterial<GAS>(*this, chunk, x, y, dirty);
+        case ACID:  return stepMaterial<ACID>(*this, chunk, x, y, dirty);
+        case LAVA:  return stepMaterial<LAVA>(*this, chunk, x, y, dirty);
+        case FIRE:  return stepMaterial<FIRE>(*this, chunk, x, y, dirty);
+        default:    return false; // empty, solid and wood do nothing by themselves
     }
-    return false;
 }
 
 bool World::inBounds(int x, int y) {
@@ -1,9 +1,29 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
 #include <vector>
+#include <limits.h>
 #include "elementUtils.h"
-#include "constants.h"
 #include "rng.h"
 
+// Bounding box, in world coordinates, of the cells changed by World::update.
+// The engine uses it to decide which cells need updating on the next tick.
+struct DirtyBox {
+    int min_x = INT_MAX;
+    int min_y = INT_MAX;
+    int max_x = INT_MIN;
+    int max_y = INT_MIN;
+
+    void include(int x, int y) {
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+    }
+    bool empty() const { return min_x > max_x; }
+};
+
 // The World class provides an interface and wrapper for the cellular matrix.
 // It includes functions to edit cells, translate between indicies and coordinates,
 // check bounds, get differing amounts of neighbors, and more.
@@ -11,27 +31,123 @@
 // interface between the matrix world and simulation.
 class World {
 public:
-    const static int width = WIDTH;
-    const static int height = HEIGHT;
-    const static int size = WIDTH * HEIGHT;
+    const int width;
+    const int height;
+    const int size;
+
+    // Cells are grouped in 16x16 chunks, each stored contiguously row by row,
+    // so a chunk's materials fill 4 cache lines.
+    const static int chunk_shift = 4;
+    const static int chunk_size = 1 << chunk_shift;
+    const static int chunk_area = chunk_size * chunk_size;
+    const int chunks_width;
+    const int chunks_height;
 
-    ElementType matrix[size];
+    // Per cell state lives in separate planes sharing the same local index, so
+    // hot loops only pull in the planes they need. Planes that describe the
+    // particle rather than the position move with it in swapCells().
+    //
+    // Bit x of settled[y] is set once the cell at local (x, y) failed to move,
+    // and cleared by unsettle() when the cell or one of its 8 neighbours
+    // changes. Whether a particle can move only depends on those 8 (it goes
+    // further only if the cell next to it is free), so a settled cell would
+    // fail again and the engine skips it. Cells that may still react never
+    // settle, as their rolls come out differently every tick.
+    struct Chunk {
+        ElementType matrix[chunk_area]; // material
+        uint8_t epochs[chunk_area];     // epoch of the tick the cell last stepped on
+        uint8_t speeds[chunk_area];     // cells per tick the particle is moving at, see MovementRules
+        uint16_t settled[chunk_size];   // per row; describes the position, not the particle
+        uint16_t settled_rows;          // bit y is set if settled[y] may have bits set
+    };
 
-    World();
+    // Epochs count 1..max_epoch and are never reused within a cycle, so
+    // "stepped this tick" is a comparison and nothing has to be cleared
+    // between ticks; 0 means never stepped.
+    const static uint32_t max_epoch = 0xFF;
+
+    // tickKey() of CELL_STREAM and of REACTION_STREAM for the current tick,
+    // and the tick's epoch, set by the engine
+    uint64_t random_key;
+    uint64_t reaction_key;
+    uint8_t epoch;
+
+    World(int width, int height); // multiples of chunk_size
     ~World();
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    static int localIndex(int x, int y) { return (y & (chunk_size - 1)) * chunk_size + (x & (chunk_size - 1)); }
+
+    // Chunks are stored sparsely: a chunk made of a single material (empty sky,
+    // bedrock, the inside of a settled pile) owns no planes and is only its
+    // fill. chunkAt() returns nullptr for those; writing a different material
+    // into one materializes it, and compact() turns it back into a fill.
+    Chunk* chunkAt(int xx, int yy) const { return chunks[xx + yy * chunks_width].load(std::memory_order_acquire); }
+    ElementType fillAt(int xx, int yy) const { return fills[xx + yy * chunks_width]; }
+    Chunk* materialize(int xx, int yy); // safe to race with other threads
+    bool compact(int xx, int yy); // only while no thread is updating the world
+    // makes the chunk uniform, freeing its planes. Settled cells around it are
+    // left alone, so it is only for building a world up.
+    void fillChunk(int xx, int yy, ElementType e);
+    int allocatedChunks() const { return allocated_chunks.load(std::memory_order_relaxed); }
+    size_t memoryUsage() const; // bytes held by chunk planes and the chunk table
 
     // modify elements
     ElementType getElementAtPosition(int x, int y);
     void swapElementsAtPositions(int x1, int x2, int y1, int y2);
     void setElementAtPosition(int x, int y, ElementType e);
     void spawnElementAtPosition(int x, int y, ElementType e);
+    // Sets the cells from (x1, y) to (x2, y), clipped to the world, to e; only
+    // the ones holding only unless that is NULL_ELEMENT. Writes a chunk's part
+    // of the span at once and leaves chunks it wouldn't change unallocated.
+    // Returns how many cells changed, which the caller unsettles and marks
+    // dirty, once for many spans.
+    int fillSpan(int x1, int x2, int y, ElementType e, ElementType only = NULL_ELEMENT);
+    static void swapCells(Chunk* a, int i, Chunk* b, int j); // swaps every particle plane, nothing else
+    void clearSpeeds(); // brings every particle to rest
+
+    // Clears the settled bits of the cells from (min_x, min_y) to (max_x, max_y),
+    // clipped to the world, after the cells inside them by one changed. Safe
+    // while the world updates, as two chunks of a phase may both reach into the
+    // chunk between them. skip, if any, is left alone.
+    void unsettle(int min_x, int min_y, int max_x, int max_y, const Chunk* skip = nullptr);
+    // the same clipped to chunk (xx, yy), only for the thread updating it
+    static void unsettleWithin(Chunk* chunk, int xx, int yy, int min_x, int min_y, int max_x, int max_y) {
+        const int mask = chunk_size - 1;
+        int first_x = std::max(min_x - (xx << chunk_shift), 0);
+        int first_y = std::max(min_y - (yy << chunk_shift), 0);
+        int last_x = std::min(max_x - (xx << chunk_shift), mask);
+        int last_y = std::min(max_y - (yy << chunk_shift), mask);
+        if (first_y > last_y || !(chunk->settled_rows >> first_y & ((2u << (last_y - first_y)) - 1))) return;
+        uint16_t keep = ~(((2u << last_x) - 1) & ~((1u << first_x) - 1));
+        for (int y = first_y; y <= last_y; y++) chunk->settled[y] &= keep;
+    }
+
+    // Bit x of rows[y] is set if the cell at local (x, y) holds an active
+    // element and has not stepped on epoch. Vectorized with AVX2 or SSE2 when
+    // the compiler targets them.
+    static void candidateRows(const Chunk* chunk, uint8_t epoch, uint16_t rows[chunk_size]);
 
-    bool update(int x, int y);
+    // Steps the cell at (x, y), which lies in chunk, adding every cell it
+    // changes to dirty. Only unsettles cells of chunk; the caller unsettles
+    // around dirty in the others. Returns whether the cell moved or reacted,
+    // or may react on a later tick, in which case it adds itself to dirty to
+    // be stepped again.
+    bool update(Chunk* chunk, int x, int y, DirtyBox& dirty);
     void reset();
+    void clearEpochs(); // resets every cell to never stepped
+
+    // FNV-1a hash of the element types in row major order
+    uint64_t hash();
 
     // helper functions
     bool inBounds(int x, int y);
 
     // std::vector<Element*> get8Neighbors(int x, int y);
-};
 
+private:
+    std::vector<std::atomic<Chunk*>> chunks; // indexed by xx + yy * chunks_width
+    std::vector<ElementType> fills;
+    std::atomic<int> allocated_chunks;
+};